@@ -4,6 +4,7 @@
 #include <cstdio>
 #include "vec3.h"
 #include "vec2.h"
+#include "../../RayTracer/SimpleRealRT/image_io.h"
 
 inline float edgeFunction(const vec2& a, const vec2& b, const vec2& c) {
   vec2 ac = c - a;
@@ -47,27 +48,16 @@ int main(int argc, char** argv) {
         float b = w0 * c0[2] + w1 * c1[2] + w2 * c2[2];
 
         // set the pixel in the image to the triangle's color
-        framebuffer[j*nx + i][0] = static_cast<unsigned char>(r*255.99);
-        framebuffer[j*nx + i][1] = static_cast<unsigned char>(g*255.99);
-        framebuffer[j*nx + i][2] = static_cast<unsigned char>(b*255.99);
+        framebuffer[j*nx + i][0] = r;
+        framebuffer[j*nx + i][1] = g;
+        framebuffer[j*nx + i][2] = b;
       }
     }
   }
 
-  std::ofstream ofs;
-  ofs.open("./raster2d.ppm");
-  ofs << "P3\n" << nx << " " << ny << "\n255\n";
+  // save as binary ppm, vec3 is three packed floats
+  write_image("./raster2d.ppm", &framebuffer[0][0], nx, ny, 3);
 
-  // save as ppm file
-  for (int j = 0; j < ny; j++) {
-    for (int i = 0; i < nx; i++) {
-      ofs << framebuffer[j*nx + i][0] << " "
-          << framebuffer[j*nx + i][1] << " "
-          << framebuffer[j*nx + i][2] << "\n";
-    }
-  }
-
-  ofs.close();
   delete []framebuffer;
   return 0;
 }
@@ -5,6 +5,7 @@
 #include "camera.h"
 #include "triangle.h"
 #include "transforms.h"
+#include "../../RayTracer/SimpleRealRT/image_io.h"
 
 // To Convenience, we just define triangles in head file.
 // This should be avoided in serious projects!
@@ -41,7 +42,7 @@ int main(int argc, char** argv) {
   vec3*  framebuffer = new vec3[sampleNum];
   float* depthbuffer = new float[sampleNum];
   // initialize frame-buffer and depth-buffer
-  for (int i = 0; i < sampleNum; i++) framebuffer[i] = vec3(255., 255., 255.);
+  for (int i = 0; i < sampleNum; i++) framebuffer[i] = vec3(1., 1., 1.);
   for (int i = 0; i < sampleNum; i++) depthbuffer[i] = farClippingPlane;
 
   // for every triangles
@@ -105,24 +106,14 @@ int main(int argc, char** argv) {
           float checker = (fmod(st.x() * M, 1.0) > 0.5) ^ (fmod(st.y() * M, 1.0) < 0.5);
           float c = 0.3 * (1 - checker) + 0.7 * checker;
           nDotView *= c;
-          framebuffer[y*imageWidth + x] = vec3(1,1,1) * static_cast<unsigned char>(nDotView * 255.99);
+          framebuffer[y*imageWidth + x] = vec3(1,1,1) * nDotView;
         }
       }
     }
   }
 
-  std::ofstream ofs;
-  ofs.open("./raster3d.ppm");
-  ofs << "P3\n" << imageWidth << " " << imageHeight << "\n255\n";
-  // save as ppm file
-  for (int j = 0; j < imageHeight; j++) {
-    for (int i = 0; i < imageWidth; i++) {
-      ofs << framebuffer[j*imageWidth + i][0] << " "
-          << framebuffer[j*imageWidth + i][1] << " "
-          << framebuffer[j*imageWidth + i][2] << "\n";
-    }
-  }
-  ofs.close();
+  // save as binary ppm, vec3 is three packed floats
+  write_image("./raster3d.ppm", &framebuffer[0][0], imageWidth, imageHeight, 3);
   delete []framebuffer;
   delete []depthbuffer;
 
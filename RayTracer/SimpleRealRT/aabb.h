@@ -9,9 +9,48 @@ axis-aligned bounding box.
 #include "vec3.h"
 #include "ray.h"
 
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
 inline float ffmin(float a, float b) { return a < b ? a : b; }
 inline float ffmax(float a, float b) { return a > b ? a : b; }
 
+// branch-free slab test on the cached inverse direction.
+// b points at 6 floats, the min corner followed by the max corner.
+inline bool slab_hit(const float* b, const ray& r, float tmin, float tmax) {
+#if defined(__SSE__)
+  // unaligned loads stay inside the ray and the 6 floats, the 4th lanes are junk
+  // until lane 2 is copied over them below
+  __m128 o = _mm_loadu_ps(r.A.e);
+  __m128 inv = _mm_loadu_ps(r.inv_B.e);
+  __m128 lo = _mm_loadu_ps(b);
+  __m128 hi = _mm_loadu_ps(b + 2);
+  hi = _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(3, 3, 2, 1));
+  __m128 t0 = _mm_mul_ps(_mm_sub_ps(lo, o), inv);
+  __m128 t1 = _mm_mul_ps(_mm_sub_ps(hi, o), inv);
+  __m128 tnear = _mm_max_ps(_mm_min_ps(t0, t1), _mm_set1_ps(tmin));
+  __m128 tfar = _mm_min_ps(_mm_max_ps(t0, t1), _mm_set1_ps(tmax));
+  tnear = _mm_shuffle_ps(tnear, tnear, _MM_SHUFFLE(2, 2, 1, 0));
+  tfar = _mm_shuffle_ps(tfar, tfar, _MM_SHUFFLE(2, 2, 1, 0));
+  // horizontal max of tnear and min of tfar
+  tnear = _mm_max_ps(tnear, _mm_movehl_ps(tnear, tnear));
+  tnear = _mm_max_ss(tnear, _mm_shuffle_ps(tnear, tnear, 1));
+  tfar = _mm_min_ps(tfar, _mm_movehl_ps(tfar, tfar));
+  tfar = _mm_min_ss(tfar, _mm_shuffle_ps(tfar, tfar, 1));
+  return _mm_cvtss_f32(tnear) < _mm_cvtss_f32(tfar);
+#else
+  // the sign picks the near plane of every axis
+  for (int a = 0; a < 3; a++) {
+    float t0 = (b[3*r.sign[a] + a] - r.A[a]) * r.inv_B[a];
+    float t1 = (b[3*(1-r.sign[a]) + a] - r.A[a]) * r.inv_B[a];
+    tmin = ffmax(t0, tmin);
+    tmax = ffmin(t1, tmax);
+  }
+  return tmin < tmax;
+#endif
+}
+
 class aabb {
  public:
   aabb() {}
@@ -19,22 +58,16 @@ class aabb {
 
   vec3 min() const { return _min; }
   vec3 max() const { return _max; }
+  vec3 center() const { return 0.5 * (_min + _max); }
+
+  // for the surface area heuristic
+  float area() const {
+    vec3 d = _max - _min;
+    return 2 * (d.x()*d.y() + d.y()*d.z() + d.z()*d.x());
+  }
 
   bool hit(const ray& r, float tmin, float tmax) const {
-    // for 3 axis x, y and z
-    for(int a = 0; a < 3; a++) {
-      // always take the bigger one as t1
-      float t0 = ffmin((_min[a] - r.origin()[a]) / r.direction()[a],
-                       (_max[a] - r.origin()[a]) / r.direction()[a]);
-      float t1 = ffmax((_min[a] - r.origin()[a]) / r.direction()[a],
-                       (_max[a] - r.origin()[a]) / r.direction()[a]);
-      tmin = ffmax(t0, tmin);
-      tmax = ffmin(t1, tmax);
-      if (tmax <= tmin) {
-        return false;
-      }
-    }
-    return true;
+    return slab_hit(_min.e, r, tmin, tmax);
   }
 
   // just two points are enough to define an AABB
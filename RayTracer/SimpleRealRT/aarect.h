@@ -3,6 +3,21 @@
 
 #include "hitable.h"
 #include "material.h"
+#include "sampler.h"
+
+// area to solid angle: distance^2 / (cosine * area), if o sees the rect along v
+inline float rect_pdf_value(const hitable* rect, float area, const vec3& o, const vec3& v) {
+  hit_record rec;
+  if (!rect->hit(ray(o, v), 0.001, FLT_MAX, rec)) return 0;
+  float distance_squared = rec.t * rec.t * v.squared_length();
+  float cosine = fabs(dot(v, rec.normal) / v.length());
+  return distance_squared / (cosine * area);
+}
+
+// the unit square of uv is stretched over a by b
+inline float rect_uv_scale(float a, float b) {
+  return 1 / sqrt(a*b);
+}
 
 class xy_rect : public hitable {
  public:
@@ -10,11 +25,24 @@ class xy_rect : public hitable {
   xy_rect(float _x0, float _x1, float _y0, float _y1, float _k, material* mat) : x0(_x0), x1(_x1),
     y0(_y0), y1(_y1), k(_k), mp(mat) {};
   virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
+  virtual int hit_packet(const ray_packet& p, int active, float t_min,
+                         float* t_max, hit_record* rec) const;
   virtual bool bounding_box(float t0, float t1, aabb& box) const {
     box = aabb(vec3(x0, y0, k-0.0001), vec3(x1, y1, k+0.0001));
     return true;
   }
 
+  virtual float pdf_value(const vec3& o, const vec3& v) const {
+    return rect_pdf_value(this, (x1-x0)*(y1-y0), o, v);
+  }
+  virtual vec3 random(const vec3& o) const {
+    float u, v;
+    random_pair(u, v);
+    float x = x0 + u*(x1-x0);
+    float y = y0 + v*(y1-y0);
+    return vec3(x, y, k) - o;
+  }
+
   material* mp;
   float x0, x1, y0, y1, k;
 };
@@ -25,11 +53,24 @@ class xz_rect : public hitable {
   xz_rect(float _x0, float _x1, float _z0, float _z1, float _k, material* mat) : x0(_x0), x1(_x1),
     z0(_z0), z1(_z1), k(_k), mp(mat) {};
   virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
+  virtual int hit_packet(const ray_packet& p, int active, float t_min,
+                         float* t_max, hit_record* rec) const;
   virtual bool bounding_box(float t0, float t1, aabb& box) const {
-    box = aabb(vec3(x0, k-0.0001, z0), vec3(x1, k-0.0001, z1));
+    box = aabb(vec3(x0, k-0.0001, z0), vec3(x1, k+0.0001, z1));
     return true;
   }
 
+  virtual float pdf_value(const vec3& o, const vec3& v) const {
+    return rect_pdf_value(this, (x1-x0)*(z1-z0), o, v);
+  }
+  virtual vec3 random(const vec3& o) const {
+    float u, v;
+    random_pair(u, v);
+    float x = x0 + u*(x1-x0);
+    float z = z0 + v*(z1-z0);
+    return vec3(x, k, z) - o;
+  }
+
   material* mp;
   float x0, x1, z0, z1, k;
 };
@@ -40,18 +81,49 @@ class yz_rect : public hitable {
   yz_rect(float _y0, float _y1, float _z0, float _z1, float _k, material* mat) : y0(_y0), y1(_y1),
     z0(_z0), z1(_z1), k(_k), mp(mat) {};
   virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
+  virtual int hit_packet(const ray_packet& p, int active, float t_min,
+                         float* t_max, hit_record* rec) const;
   virtual bool bounding_box(float t0, float t1, aabb& box) const {
-    box = aabb(vec3(k-0.0001, y0, z0), vec3(k-0.0001, y1, z1));
+    box = aabb(vec3(k-0.0001, y0, z0), vec3(k+0.0001, y1, z1));
     return true;
   }
 
+  virtual float pdf_value(const vec3& o, const vec3& v) const {
+    return rect_pdf_value(this, (y1-y0)*(z1-z0), o, v);
+  }
+  virtual vec3 random(const vec3& o) const {
+    float u, v;
+    random_pair(u, v);
+    float y = y0 + u*(y1-y0);
+    float z = z0 + v*(z1-z0);
+    return vec3(k, y, z) - o;
+  }
+
   material* mp;
   float y0, y1, z0, z1, k;
 };
 
+// lanes hitting the rectangle [a0, a1] x [b0, b1] of the plane
+// axis C = k, with A and B the in-plane axes. the hit distances go to t.
+template <int A, int B, int C>
+inline int rect_packet_hit(const ray_packet& p, int active, float t_min, const float* t_max,
+                           float a0, float a1, float b0, float b1, float k, float* t) {
+  int mask = 0;
+  for (int i = 0; i < packet_size; i++) {
+    t[i] = (k - p.o[C][i]) / p.d[C][i];
+    float a = p.o[A][i] + t[i]*p.d[A][i];
+    float b = p.o[B][i] + t[i]*p.d[B][i];
+    bool inside = (t[i] >= t_min && t[i] <= t_max[i]) &&
+                  !(a < a0 || a > a1 || b < b0 || b > b1);
+    mask |= inside << i;
+  }
+  return mask & active;
+}
+
 bool xy_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
   float t = (k - r.origin().z()) / r.direction().z();
-  if (t < t0 || t > t1) return false;
+  // also rejects nan, a ray in the plane of the rect
+  if (!(t >= t0 && t <= t1)) return false;
 
   // find hit position
   float x = r.origin().x() + t*r.direction().x();
@@ -66,12 +138,14 @@ bool xy_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
   rec.mat_ptr = mp;
   rec.p = r.point_at_parameter(t);
   rec.normal = vec3(0, 0, 1);
+  rec.uv_scale = rect_uv_scale(x1-x0, y1-y0);
   return true;
 }
 
 bool xz_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
   float t = (k - r.origin().y()) / r.direction().y();
-  if (t < t0 || t > t1) return false;
+  // also rejects nan, a ray in the plane of the rect
+  if (!(t >= t0 && t <= t1)) return false;
 
   // find hit position
   float x = r.origin().x() + t*r.direction().x();
@@ -86,12 +160,14 @@ bool xz_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
   rec.mat_ptr = mp;
   rec.p = r.point_at_parameter(t);
   rec.normal = vec3(0, 1, 0);
+  rec.uv_scale = rect_uv_scale(x1-x0, z1-z0);
   return true;
 }
 
 bool yz_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
   float t = (k - r.origin().x()) / r.direction().x();
-  if (t < t0 || t > t1) return false;
+  // also rejects nan, a ray in the plane of the rect
+  if (!(t >= t0 && t <= t1)) return false;
 
   // find hit position
   float y = r.origin().y() + t*r.direction().y();
@@ -106,7 +182,59 @@ bool yz_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
   rec.mat_ptr = mp;
   rec.p = r.point_at_parameter(t);
   rec.normal = vec3(1, 0, 0);
+  rec.uv_scale = rect_uv_scale(y1-y0, z1-z0);
   return true;
 }
 
+int xy_rect::hit_packet(const ray_packet& p, int active, float t_min,
+                        float* t_max, hit_record* rec) const {
+  float t[packet_size];
+  int mask = rect_packet_hit<0, 1, 2>(p, active, t_min, t_max, x0, x1, y0, y1, k, t);
+  for (int i = 0; i < packet_size; i++) {
+    if (!(mask & (1 << i))) continue;
+    rec[i].u = (p.o[0][i] + t[i]*p.d[0][i] - x0) / (x1-x0);
+    rec[i].v = (p.o[1][i] + t[i]*p.d[1][i] - y0) / (y1-y0);
+    rec[i].t = t_max[i] = t[i];
+    rec[i].mat_ptr = mp;
+    rec[i].p = p.r[i].point_at_parameter(t[i]);
+    rec[i].normal = vec3(0, 0, 1);
+    rec[i].uv_scale = rect_uv_scale(x1-x0, y1-y0);
+  }
+  return mask;
+}
+
+int xz_rect::hit_packet(const ray_packet& p, int active, float t_min,
+                        float* t_max, hit_record* rec) const {
+  float t[packet_size];
+  int mask = rect_packet_hit<0, 2, 1>(p, active, t_min, t_max, x0, x1, z0, z1, k, t);
+  for (int i = 0; i < packet_size; i++) {
+    if (!(mask & (1 << i))) continue;
+    rec[i].u = (p.o[0][i] + t[i]*p.d[0][i] - x0) / (x1-x0);
+    rec[i].v = (p.o[2][i] + t[i]*p.d[2][i] - z0) / (z1-z0);
+    rec[i].t = t_max[i] = t[i];
+    rec[i].mat_ptr = mp;
+    rec[i].p = p.r[i].point_at_parameter(t[i]);
+    rec[i].normal = vec3(0, 1, 0);
+    rec[i].uv_scale = rect_uv_scale(x1-x0, z1-z0);
+  }
+  return mask;
+}
+
+int yz_rect::hit_packet(const ray_packet& p, int active, float t_min,
+                        float* t_max, hit_record* rec) const {
+  float t[packet_size];
+  int mask = rect_packet_hit<1, 2, 0>(p, active, t_min, t_max, y0, y1, z0, z1, k, t);
+  for (int i = 0; i < packet_size; i++) {
+    if (!(mask & (1 << i))) continue;
+    rec[i].u = (p.o[1][i] + t[i]*p.d[1][i] - y0) / (y1-y0);
+    rec[i].v = (p.o[2][i] + t[i]*p.d[2][i] - z0) / (z1-z0);
+    rec[i].t = t_max[i] = t[i];
+    rec[i].mat_ptr = mp;
+    rec[i].p = p.r[i].point_at_parameter(t[i]);
+    rec[i].normal = vec3(1, 0, 0);
+    rec[i].uv_scale = rect_uv_scale(y1-y0, z1-z0);
+  }
+  return mask;
+}
+
 #endif
@@ -0,0 +1,171 @@
+#ifndef __ADAPTIVEH__
+#define __ADAPTIVEH__
+/*
+class adaptive_sampler.
+per-pixel adaptive sampling. every pixel keeps the running mean and
+variance of its sample luminance (welford). once a pixel has min_spp
+samples and the relative standard error of its mean is below the
+threshold, it gets no more samples. flat walls and the background
+stop early, the budget goes to the noisy pixels.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include "render.h"
+
+struct adaptive_options {
+  adaptive_options()
+    : min_spp(64), max_spp(1000), threshold(0.05), epsilon(0.01) {}
+
+  int min_spp;
+  int max_spp;
+  // relative standard error of the pixel mean to stop at
+  float threshold;
+  // added to the mean, so dark pixels need not reach a tiny absolute error
+  float epsilon;
+};
+
+class adaptive_sampler {
+ public:
+  adaptive_sampler(const camera& c, hitable* w, background e, const hitable* l,
+                   const adaptive_options& o, int nx, int ny)
+    : cam(c), world(w), env(e), lights(l), opt(o),
+      n(nx*ny, 0), mean(nx*ny, 0), m2(nx*ny, 0), active(nx*ny, 1) {}
+
+  // n more samples for every pixel that has not converged yet, can be
+  // used as the pass of render_progressive()
+  void operator()(framebuffer& fb, int ns, int tile_size = 16);
+  // passes of pass_spp until all pixels have converged
+  void render(framebuffer& fb, int pass_spp = 16);
+  int active_pixels() const {
+    return static_cast<int>(std::count(active.begin(), active.end(), 1));
+  }
+  // the spp distribution over the image
+  void report(const framebuffer& fb, std::ostream& os) const;
+
+  const camera& cam;
+  hitable* world;
+  background env;
+  const hitable* lights;
+  adaptive_options opt;
+
+  // welford state of the sample luminance, per pixel
+  std::vector<int> n;
+  std::vector<float> mean;
+  std::vector<float> m2;
+  std::vector<char> active;
+
+ private:
+  void add(int p, const vec3& c) {
+    float x = luminance(c);
+    n[p]++;
+    float delta = x - mean[p];
+    mean[p] += delta / n[p];
+    m2[p] += delta * (x - mean[p]);
+  }
+  bool converged(int p, int spp) const;
+  void update_active(const framebuffer& fb);
+};
+
+bool adaptive_sampler::converged(int p, int spp) const {
+  if (spp >= opt.max_spp) return true;
+  if (n[p] < opt.min_spp) return false;
+  // standard error of the mean over the mean
+  float error = std::sqrt(m2[p] / (n[p] - 1) / n[p]);
+  return error < opt.threshold * (mean[p] + opt.epsilon);
+}
+
+void adaptive_sampler::operator()(framebuffer& fb, int ns, int tile_size) {
+  int ntx = (fb.nx + tile_size - 1) / tile_size;
+  int nty = (fb.ny + tile_size - 1) / tile_size;
+
+  render_pool().parallel_for(ntx*nty, [&](int tile) {
+    int i0 = (tile % ntx) * tile_size;
+    int j0 = (tile / ntx) * tile_size;
+    int i1 = std::min(i0 + tile_size, fb.nx);
+    int j1 = std::min(j0 + tile_size, fb.ny);
+    for (int j = j0; j < j1; j++) {
+      // the pixels left in this row go out in packets
+      int xs[packet_size];
+      int m = 0;
+      for (int i = i0; i < i1; i++) {
+        if (active[j*fb.nx + i]) xs[m++] = i;
+        if (m < packet_size && i < i1 - 1) continue;
+        if (m == 0) continue;
+
+        int count = ns;
+        for (int k = 0; k < m; k++)
+          count = std::min(count, opt.max_spp - fb.count[j*fb.nx + xs[k]]);
+        vec3 colorx[packet_size];
+        for (int k = 0; k < m; k++) colorx[k] = vec3(0, 0, 0);
+        for (int s = 0; s < count; s++) {
+          vec3 c[packet_size];
+          feature_sample f[packet_size];
+          bool keep = fb.has_features();
+          trace_packet(fb, cam, world, env, lights, j, xs, m, s, c, keep ? f : nullptr);
+          for (int k = 0; k < m; k++) {
+            colorx[k] += c[k];
+            add(j*fb.nx + xs[k], c[k]);
+            if (keep) fb.add_features(j*fb.nx + xs[k], f[k], c[k]);
+          }
+        }
+        for (int k = 0; k < m; k++) {
+          int p = j*fb.nx + xs[k];
+          fb.sum[p] += colorx[k];
+          fb.count[p] += count;
+        }
+        m = 0;
+      }
+    }
+  });
+  update_active(fb);
+}
+
+// a pixel goes on while it or one of its 8 neighbours has not
+// converged. the variance of a few samples is easily 0 when a rare
+// path carries all the light, the neighbours catch most of those.
+void adaptive_sampler::update_active(const framebuffer& fb) {
+  std::vector<char> done(fb.nx*fb.ny);
+  for (int p = 0; p < fb.nx*fb.ny; p++)
+    done[p] = !active[p] || converged(p, fb.count[p]);
+  for (int j = 0; j < fb.ny; j++) {
+    for (int i = 0; i < fb.nx; i++) {
+      bool go = false;
+      for (int y = std::max(j-1, 0); y <= std::min(j+1, fb.ny-1); y++)
+        for (int x = std::max(i-1, 0); x <= std::min(i+1, fb.nx-1); x++)
+          go = go || !done[y*fb.nx + x];
+      active[j*fb.nx + i] = go && fb.count[j*fb.nx + i] < opt.max_spp;
+    }
+  }
+}
+
+void adaptive_sampler::render(framebuffer& fb, int pass_spp) {
+  while (active_pixels() > 0) (*this)(fb, pass_spp);
+}
+
+void adaptive_sampler::report(const framebuffer& fb, std::ostream& os) const {
+  // power of two buckets
+  std::vector<int> histogram;
+  long total = 0;
+  for (int c : fb.count) {
+    int b = 0;
+    while ((2 << b) <= c) b++;
+    if (b >= static_cast<int>(histogram.size())) histogram.resize(b + 1, 0);
+    histogram[b]++;
+    total += c;
+  }
+  os << "spp distribution:\n";
+  for (int b = 0; b < static_cast<int>(histogram.size()); b++) {
+    if (histogram[b] == 0) continue;
+    os << "  [" << (1 << b) << ", " << (2 << b) << ") "
+       << histogram[b] << " pixels, "
+       << 100.0 * histogram[b] / fb.count.size() << "%\n";
+  }
+  double average = static_cast<double>(total) / fb.count.size();
+  os << "average " << average << " spp, " << opt.max_spp / average
+     << "x fewer samples than " << opt.max_spp << " spp everywhere\n";
+}
+
+#endif
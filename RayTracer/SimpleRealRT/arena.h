@@ -0,0 +1,133 @@
+#ifndef __ARENAH__
+#define __ARENAH__
+/*
+class arena.
+a monotonic allocator to build a scene in. objects are placed one
+after another in large blocks and never freed one by one. the arena's
+destructor (or release()) runs the destructors of the objects that
+have one, newest first, and frees the blocks, so a scene is torn down
+at once.
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+class arena {
+ public:
+  arena(size_t block = 64*1024)
+    : block_size(block), current(nullptr), left(0), cleanup(nullptr), used(0) {}
+  ~arena() { release(); }
+  arena(const arena&) = delete;
+  arena& operator=(const arena&) = delete;
+
+  void* allocate(size_t size, size_t align);
+  // construct a T in the arena
+  template <class T, class... Args>
+  T* make(Args&&... args);
+  // n value initialized elements, e.g. the hitable* list of a scene
+  template <class T>
+  T* make_array(size_t n);
+  // destroy all objects and free all blocks, the arena can be used again
+  void release();
+
+  size_t bytes_used() const { return used; }
+  size_t bytes_reserved() const;
+
+ private:
+  // kept in the arena itself, a stack of the destructors to run
+  struct destructor {
+    void (*destroy)(void*);
+    void* object;
+    destructor* next;
+  };
+  template <class T>
+  static void destroy(void* p) { static_cast<T*>(p)->~T(); }
+
+  size_t block_size;
+  std::vector<std::pair<char*, size_t> > blocks;
+  char* current;
+  size_t left;
+  destructor* cleanup;
+  size_t used;
+};
+
+void* arena::allocate(size_t size, size_t align) {
+  size_t pad = (align - reinterpret_cast<uintptr_t>(current) % align) % align;
+  if (!current || pad + size > left) {
+    // large objects get a block of their own
+    size_t n = std::max(block_size, size + align);
+    char* b = static_cast<char*>(malloc(n));
+    if (!b) throw std::bad_alloc();
+    blocks.push_back(std::make_pair(b, n));
+    current = b;
+    left = n;
+    pad = (align - reinterpret_cast<uintptr_t>(current) % align) % align;
+  }
+  void* p = current + pad;
+  current += pad + size;
+  left -= pad + size;
+  used += size;
+  return p;
+}
+
+template <class T, class... Args>
+T* arena::make(Args&&... args) {
+  T* p = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+  if (!std::is_trivially_destructible<T>::value) {
+    destructor* d = new (allocate(sizeof(destructor), alignof(destructor))) destructor;
+    d->destroy = &destroy<T>;
+    d->object = p;
+    d->next = cleanup;
+    cleanup = d;
+  }
+  return p;
+}
+
+template <class T>
+T* arena::make_array(size_t n) {
+  static_assert(std::is_trivially_destructible<T>::value,
+                "arena arrays are for pointers and plain values");
+  T* p = static_cast<T*>(allocate(n * sizeof(T), alignof(T)));
+  for (size_t k = 0; k < n; k++) new (p + k) T();
+  return p;
+}
+
+void arena::release() {
+  for (destructor* d = cleanup; d; d = d->next)
+    d->destroy(d->object);
+  cleanup = nullptr;
+  for (size_t k = 0; k < blocks.size(); k++)
+    free(blocks[k].first);
+  blocks.clear();
+  current = nullptr;
+  left = 0;
+  used = 0;
+}
+
+size_t arena::bytes_reserved() const {
+  size_t n = 0;
+  for (size_t k = 0; k < blocks.size(); k++) n += blocks[k].second;
+  return n;
+}
+
+// from the arena when there is one, from the heap otherwise. for the
+// constructors that build parts of their own (block, constant_medium).
+template <class T, class... Args>
+T* arena_new(arena* a, Args&&... args) {
+  if (a) return a->make<T>(std::forward<Args>(args)...);
+  return new T(std::forward<Args>(args)...);
+}
+
+template <class T>
+T* arena_new_array(arena* a, size_t n) {
+  if (a) return a->make_array<T>(n);
+  return new T[n]();
+}
+
+#endif
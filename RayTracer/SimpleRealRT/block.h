@@ -2,34 +2,40 @@
 #define __BLOCKH__
 
 #include "aarect.h"
+#include "arena.h"
 #include "hitable_list.h"
 
 class block : public hitable {
  public:
   block() {}
-  block(const vec3& p0, const vec3& p1, material* ptr);
+  // the sides come from a when given, from the heap otherwise
+  block(const vec3& p0, const vec3& p1, material* ptr, arena* a = nullptr);
   virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
   virtual bool bounding_box(float t0, float t1, aabb& box) const {
     box = aabb(pmin, pmax);
     return true;
   }
+  virtual int hit_packet(const ray_packet& p, int active, float t_min,
+                         float* t_max, hit_record* rec) const {
+    return list_ptr->hit_packet(p, active, t_min, t_max, rec);
+  }
   vec3 pmin, pmax;
   hitable* list_ptr;
 };
 
-block::block(const vec3& p0, const vec3& p1, material* ptr) {
+block::block(const vec3& p0, const vec3& p1, material* ptr, arena* a) {
   pmin = p0;
   pmax = p1;
 
-  hitable** list = new hitable*[6];
+  hitable** list = arena_new_array<hitable*>(a, 6);
   // define 6 rectangles to make a block
-  list[0] = new xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), ptr);
-  list[1] = new flip_normals(new xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), ptr));
-  list[2] = new xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), ptr);
-  list[3] = new flip_normals(new xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), ptr));
-  list[4] = new yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), ptr);
-  list[5] = new flip_normals(new yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), ptr));
-  list_ptr = new hitable_list(list, 6);
+  list[0] = arena_new<xy_rect>(a, p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), ptr);
+  list[1] = arena_new<flip_normals>(a, arena_new<xy_rect>(a, p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), ptr));
+  list[2] = arena_new<xz_rect>(a, p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), ptr);
+  list[3] = arena_new<flip_normals>(a, arena_new<xz_rect>(a, p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), ptr));
+  list[4] = arena_new<yz_rect>(a, p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), ptr);
+  list[5] = arena_new<flip_normals>(a, arena_new<yz_rect>(a, p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), ptr));
+  list_ptr = arena_new<hitable_list>(a, list, 6);
 }
 
 bool block::hit(const ray& r, float t0, float t1, hit_record& rec) const {
@@ -3,16 +3,150 @@
 /*
 class bvh.
 for bvh binary tree construction.
+the tree is split by a binned surface area heuristic (SAH).
  */
 
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+#include "arena.h"
 #include "hitable.h"
 
+// what the builder needs to know about a primitive, gathered once
+struct bvh_primitive {
+  aabb box;
+  vec3 centroid;
+  int index;
+};
+
+const int sah_bins = 16;
+
+// the traversal stacks hold one entry per level of the tree (W-1 per
+// level for wide trees). past bvh_sah_depth the builders split at the
+// median, which halves the primitives, so any tree of less than 2^31
+// primitives stays below bvh_stack_size levels.
+const int bvh_stack_size = 64;
+const int bvh_sah_depth = 32;
+
+inline aabb empty_box() {
+  return aabb(vec3(FLT_MAX, FLT_MAX, FLT_MAX), vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+}
+
+aabb primitive_bounds(const bvh_primitive* prims, int n) {
+  aabb box = empty_box();
+  for (int i = 0; i < n; i++)
+    box = surrounding_box(box, prims[i].box);
+  return box;
+}
+
+// clamped both ways, a NaN offset lands in bin 0
+inline int sah_bin(float c, float cmin, float scale) {
+  float x = (c - cmin) * scale;
+  if (!(x > 0)) return 0;
+  return x < sah_bins ? static_cast<int>(x) : sah_bins-1;
+}
+
+// reorder prims in place and return the size of the left part, in [1, n-1].
+// the split plane is the bin border of the lowest cost
+//   cost = n_left * area_left + n_right * area_right
+// its axis is stored in split_axis when asked for.
+int sah_split(bvh_primitive* prims, int n, int* split_axis = nullptr) {
+  aabb centroids(prims[0].centroid, prims[0].centroid);
+  for (int i = 1; i < n; i++)
+    centroids = surrounding_box(centroids, aabb(prims[i].centroid, prims[i].centroid));
+
+  float best_cost = FLT_MAX;
+  int best_axis = -1;
+  int best_bin = 0;
+  for (int a = 0; a < 3; a++) {
+    float extent = centroids.max()[a] - centroids.min()[a];
+    if (!(extent > 0) || !std::isfinite(extent)) continue;
+    float scale = sah_bins / extent;
+
+    int count[sah_bins] = {0};
+    aabb bounds[sah_bins];
+    for (int b = 0; b < sah_bins; b++) bounds[b] = empty_box();
+    for (int i = 0; i < n; i++) {
+      int b = sah_bin(prims[i].centroid[a], centroids.min()[a], scale);
+      count[b]++;
+      bounds[b] = surrounding_box(bounds[b], prims[i].box);
+    }
+
+    // sweep from the right, then from the left
+    float right_area[sah_bins];
+    aabb acc = empty_box();
+    for (int b = sah_bins-1; b > 0; b--) {
+      acc = surrounding_box(acc, bounds[b]);
+      right_area[b] = acc.area();
+    }
+    acc = empty_box();
+    int left_count = 0;
+    for (int b = 0; b < sah_bins-1; b++) {
+      acc = surrounding_box(acc, bounds[b]);
+      left_count += count[b];
+      if (left_count == 0 || left_count == n) continue;
+      float cost = left_count*acc.area() + (n-left_count)*right_area[b+1];
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_axis = a;
+        best_bin = b;
+      }
+    }
+  }
+
+  if (split_axis) *split_axis = best_axis < 0 ? 0 : best_axis;
+  if (best_axis < 0) {
+    // all centroids coincide, any split is as good as the median
+    return n / 2;
+  }
+  float cmin = centroids.min()[best_axis];
+  float scale = sah_bins / (centroids.max()[best_axis] - cmin);
+  bvh_primitive* mid = std::partition(prims, prims + n, [&](const bvh_primitive& p) {
+    return sah_bin(p.centroid[best_axis], cmin, scale) <= best_bin;
+  });
+  return static_cast<int>(mid - prims);
+}
+
+// reorder prims in place around the median centroid of the widest
+// axis, returns n / 2
+int median_split(bvh_primitive* prims, int n, int* split_axis = nullptr) {
+  aabb centroids(prims[0].centroid, prims[0].centroid);
+  for (int i = 1; i < n; i++)
+    centroids = surrounding_box(centroids, aabb(prims[i].centroid, prims[i].centroid));
+  int axis = 0;
+  for (int a = 1; a < 3; a++) {
+    float extent = centroids.max()[a] - centroids.min()[a];
+    if (extent > centroids.max()[axis] - centroids.min()[axis]) axis = a;
+  }
+  if (split_axis) *split_axis = axis;
+  std::nth_element(prims, prims + n/2, prims + n, [&](const bvh_primitive& p, const bvh_primitive& q) {
+    return p.centroid[axis] < q.centroid[axis];
+  });
+  return n / 2;
+}
+
+// box and centroid of every hitable, the only virtual calls of a build
+std::vector<bvh_primitive> gather_primitives(hitable** l, int n, float time0, float time1) {
+  std::vector<bvh_primitive> prims(n);
+  for (int i = 0; i < n; i++) {
+    if (!l[i]->bounding_box(time0, time1, prims[i].box))
+      std::cerr << "no bounding box in bvh_node constructor\n";
+    prims[i].centroid = prims[i].box.center();
+    prims[i].index = i;
+  }
+  return prims;
+}
+
 class bvh_node : public hitable {
  public:
   bvh_node() {}
-  bvh_node(hitable** l, int n, float time0, float time1);
+  // the inner nodes come from a when given, from the heap otherwise
+  bvh_node(hitable** l, int n, float time0, float time1, arena* a = nullptr);
+  bvh_node(hitable** l, bvh_primitive* prims, int n, arena* a = nullptr) { build(l, prims, n, a); }
   virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
   virtual bool bounding_box(float t0, float t1, aabb& box) const;
+  void build(hitable** l, bvh_primitive* prims, int n, arena* a = nullptr);
 
   hitable* left;
   hitable* right;
@@ -49,69 +183,24 @@ bool bvh_node::hit(const ray& r, float t_min, float t_max, hit_record& rec) cons
   }
 }
 
-int box_x_compare (const void* a, const void* b) {
-  aabb box_left, box_right;
-  hitable *ah = *(hitable**)a;
-  hitable *bh = *(hitable**)b;
-  if(!ah->bounding_box(0,0, box_left) || !bh->bounding_box(0,0, box_right))
-    std::cerr << "no bounding box in bvh_node constructor\n";
-  if (box_left.min().x() - box_right.min().x() < 0.0)
-    return -1;
-  else
-    return 1;
+bvh_node::bvh_node(hitable** l, int n, float time0, float time1, arena* a) {
+  std::vector<bvh_primitive> prims = gather_primitives(l, n, time0, time1);
+  build(l, prims.data(), n, a);
 }
 
-int box_y_compare (const void* a, const void* b) {
-  aabb box_left, box_right;
-  hitable *ah = *(hitable**)a;
-  hitable *bh = *(hitable**)b;
-  if(!ah->bounding_box(0,0, box_left) || !bh->bounding_box(0,0, box_right))
-    std::cerr << "no bounding box in bvh_node constructor\n";
-  if (box_left.min().y() - box_right.min().y() < 0.0)
-    return -1;
-  else
-    return 1;
-}
-
-int box_z_compare (const void* a, const void* b) {
-  aabb box_left, box_right;
-  hitable *ah = *(hitable**)a;
-  hitable *bh = *(hitable**)b;
-  if(!ah->bounding_box(0,0, box_left) || !bh->bounding_box(0,0, box_right))
-    std::cerr << "no bounding box in bvh_node constructor\n";
-  if (box_left.min().z() - box_right.min().z() < 0.0)
-    return -1;
-  else
-    return 1;
-}
-
-bvh_node::bvh_node(hitable** l, int n, float time0, float time1) {
-  int axis = static_cast<int>(3*drand48());
-  // first sort the hitable list
-  if (axis == 0) {
-    qsort(l, n, sizeof(hitable*), box_x_compare);
-  } else if (axis == 1) {
-    qsort(l, n, sizeof(hitable*), box_y_compare);
-  } else {
-    qsort(l, n, sizeof(hitable*), box_z_compare);
-  }
-
-  // construct bvh recursively
+// construct bvh recursively on the gathered primitives
+void bvh_node::build(hitable** l, bvh_primitive* prims, int n, arena* a) {
+  box = primitive_bounds(prims, n);
   if (n == 1) {
-    left = right = l[0];
+    left = right = l[prims[0].index];
   } else if (n == 2) {
-    left = l[0];
-    right = l[1];
+    left = l[prims[0].index];
+    right = l[prims[1].index];
   } else {
-    left = new bvh_node(l, n/2, time0, time1);
-    right = new bvh_node(l+n/2, n-n/2, time0, time1);
-  }
-
-  aabb box_left, box_right;
-  if (!left->bounding_box(time0, time1, box_left) || !right->bounding_box(time0, time1, box_right)) {
-    std::cerr << "no bounding box in bvh_node constructor\n";
+    int mid = sah_split(prims, n);
+    left = arena_new<bvh_node>(a, l, prims, mid, a);
+    right = arena_new<bvh_node>(a, l, prims + mid, n - mid, a);
   }
-  box = surrounding_box(box_left, box_right);
 }
 
 #endif
@@ -5,13 +5,13 @@ Class camera
  */
 
 #include "ray.h"
+#include "sampler.h"
 
 vec3 random_in_unit_disk() {
-  vec3 p;
-  do {
-    p = 2.0 * vec3(drand48(), drand48(), 0) - vec3(1, 1, 0);
-  } while (dot(p, p) >= 1.0);
-  return p;
+  float u, v, x, y;
+  random_pair(u, v);
+  concentric_disk(u, v, x, y);
+  return vec3(x, y, 0);
 }
 
 class camera {
@@ -40,17 +40,22 @@ class camera {
     vertical = 2 * (half_height*focus_dist) * v;
   }
 
-  ray get_ray(float s, float t) {
+  ray get_ray(float s, float t) const {
     // defocus blur
     vec3 rd = lens_radius * random_in_unit_disk();
     vec3 offset = u * rd.x() + v * rd.y();
     // time sample during shutter open
-    float time = time0 + drand48()*(time1 - time0);
+    float time = time0 + random_float()*(time1 - time0);
     return ray(origin + offset,
                lower_left_corner + s*horizontal + t*vertical - (origin + offset),
                time);
   }
 
+  // the angle one of ny pixel rows spans, the spread of a ray cone
+  float pixel_spread(int ny) const {
+    return vertical.length() / (ny * (lower_left_corner + 0.5*horizontal + 0.5*vertical - origin).length());
+  }
+
   vec3 origin;
   vec3 lower_left_corner;
   vec3 horizontal;
@@ -2,14 +2,18 @@
 #define __CMEDH__
 
 #include <cfloat>
+#include "arena.h"
 #include "hitable.h"
 #include "material.h"
+#include "sampler.h"
 #include "texture.h"
 
 class constant_medium : public hitable {
  public:
-  constant_medium(hitable* b, float d, texture* a) : boundary(b), density(d) {
-    phase_function = new isotropic(a);
+  // the phase function comes from ar when given, from the heap otherwise
+  constant_medium(hitable* b, float d, texture* a, arena* ar = nullptr)
+    : boundary(b), density(d) {
+    phase_function = arena_new<isotropic>(ar, a);
   }
   virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
   virtual bool bounding_box(float t0, float t1, aabb& box) const {
@@ -31,13 +35,14 @@ bool constant_medium::hit(const ray& r, float t_min, float t_max, hit_record& re
       if (rec1.t < 0) rec1.t = 0;
 
       float distance_inside_boundary = (rec2.t - rec1.t) * r.direction().length();
-      float hit_distance = -(1/density) * log(drand48());
+      float hit_distance = -(1/density) * log(random_float());
 
       // If that distanceis inside the volume
       if (hit_distance < distance_inside_boundary) {
         rec.t = rec1.t + hit_distance / r.direction().length();
         rec.p = r.point_at_parameter(rec.t);
         rec.normal = vec3(1,0,0); // no need (because of isotropic), any one is ok
+        rec.uv_scale = 0;
         rec.mat_ptr = phase_function;
         return true;
       }
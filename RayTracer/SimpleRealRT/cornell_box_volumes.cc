@@ -1,63 +1,61 @@
 #include <cstdlib>
 #include <iostream>
 #include <iostream>
+#include "arena.h"
 #include "bvh.h"
+#include "linear_bvh.h"
 #include "noise.h"
 #include "block.h"
+#include "instance.h"
 #include "aarect.h"
 #include "sphere.h"
 #include "camera.h"
+#include "render.h"
+#include "adaptive.h"
+#include "progressive.h"
+#include "integrator.h"
 #include "texture.h"
 #include "material.h"
 #include "hitable_list.h"
 #include "constant_medium.h"
 
-vec3 color(const ray& r, hitable* world, int iter) {
-  hit_record rec;
-  if (world->hit(r, 0.001, MAXFLOAT, rec)) {
-    ray scattered;
-    vec3 attenuation;
-    vec3 emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
-    if (iter < 50 && rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
-      return emitted + attenuation * color(scattered, world, iter+1);
-    } else {
-      return emitted;
-    }
-  } else {
-    // no indirect environment light
-    return vec3(0., 0., 0.);
-  }
-}
-
-hitable* cornell_box() {
-    hitable** list = new hitable*[8];
+hitable* cornell_box(arena& scene, hitable** lights) {
+    hitable** list = scene.make_array<hitable*>(8);
     int i = 0;
-    material* red = new lambertian( new constant_texture(vec3(0.65, 0.05, 0.05)) );
-    material* white = new lambertian( new constant_texture(vec3(0.73, 0.73, 0.73)) );
-    material* green = new lambertian( new constant_texture(vec3(0.12, 0.45, 0.15)) );
-    material* light = new diffuse_light( new constant_texture(vec3(7, 7, 7)) );
-    list[i++] = new flip_normals(new yz_rect(0, 555, 0, 555, 555, green));
-    list[i++] = new yz_rect(0, 555, 0, 555, 0, red);
-    list[i++] = new xz_rect(113, 443, 127, 432, 554, light); // use a bigger and dimmer light
-    list[i++] = new flip_normals(new xz_rect(0, 555, 0, 555, 555, white));
-    list[i++] = new xz_rect(0, 555, 0, 555, 0, white);
-    list[i++] = new flip_normals(new xy_rect(0, 555, 0, 555, 555, white));
+    material* red = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.65, 0.05, 0.05)) );
+    material* white = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.73, 0.73, 0.73)) );
+    material* green = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.12, 0.45, 0.15)) );
+    material* light = scene.make<diffuse_light>( scene.make<constant_texture>(vec3(7, 7, 7)) );
+    list[i++] = scene.make<flip_normals>(scene.make<yz_rect>(0, 555, 0, 555, 555, green));
+    list[i++] = scene.make<yz_rect>(0, 555, 0, 555, 0, red);
+    // the light is sampled directly too
+    *lights = scene.make<xz_rect>(113, 443, 127, 432, 554, light); // use a bigger and dimmer light
+    list[i++] = *lights;
+    list[i++] = scene.make<flip_normals>(scene.make<xz_rect>(0, 555, 0, 555, 555, white));
+    list[i++] = scene.make<xz_rect>(0, 555, 0, 555, 0, white);
+    list[i++] = scene.make<flip_normals>(scene.make<xy_rect>(0, 555, 0, 555, 555, white));
 
-    hitable* b1 = new translate(new rotate_y(new block(vec3(0, 0, 0), vec3(165, 165, 165), white), -18), vec3(130,0,65));
-    hitable* b2 = new translate(new rotate_y(new block(vec3(0, 0, 0), vec3(165, 330, 165), white),  15), vec3(265,0,295));
-    list[i++] = new constant_medium(b1, 0.03, new constant_texture(vec3(1., 1., 1.))); // a white volume
-    list[i++] = new constant_medium(b2, 0.01, new constant_texture(vec3(0., 0., 0.))); // a black volume
-    return new hitable_list(list, i);
+    // one unit cube, both boxes are instances of it
+    hitable* cube = scene.make<block>(vec3(0, 0, 0), vec3(1, 1, 1), white, &scene);
+    hitable* b1 = scene.make<instance>(cube, affine::translation(vec3(130,0,65)) *
+        affine::rotation_y(-18) * affine::scaling(vec3(165, 165, 165)));
+    hitable* b2 = scene.make<instance>(cube, affine::translation(vec3(265,0,295)) *
+        affine::rotation_y(15) * affine::scaling(vec3(165, 330, 165)));
+    list[i++] = scene.make<constant_medium>(b1, 0.03, scene.make<constant_texture>(vec3(1., 1., 1.)), &scene); // a white volume
+    list[i++] = scene.make<constant_medium>(b2, 0.01, scene.make<constant_texture>(vec3(0., 0., 0.)), &scene); // a black volume
+    return scene.make<linear_bvh>(list, i, 0.0, 1.0);
 }
 
-int main() {
+int main(int argc, char** argv) {
   int nx = 1200;
   int ny = 800;
-  // spp 1000
-  int ns = 1000;
+  // spp 100, the light is sampled directly
+  int ns = 100;
 
-  std::cout << "P3\n" << nx << " " << ny << "\n255\n";
-  hitable* world = cornell_box();
+  // everything the scene is built of, freed at once
+  arena scene;
+  hitable* lights;
+  hitable* world = cornell_box(scene, &lights);
 
   // camera info.
   // Note that we look to z direction this time.
@@ -70,27 +68,22 @@ int main() {
   camera cam(lookfrom, lookat, vec3(0,1,0), vfov,
              aspect, aperture, dist_to_focus, 0.0, 1.0);
 
-  for (int j = ny-1; j >= 0; j--) {
-    for (int i = 0; i < nx; i++) {
-      vec3 colorx(0, 0, 0);
-
-      // for a given pixel, we have several samples,
-      // and send rays through each of the samples.
-      for(int s = 0; s < ns; s++) {
-        float u  = static_cast<float>(i + drand48()) / static_cast<float>(nx);
-        float v = static_cast<float>(j + drand48()) / static_cast<float>(ny);
-        ray r = cam.get_ray(u, v);
-        colorx += color(r, world, 0);
-      }
-      colorx /= static_cast<float>(ns);
+  // up to ns spp, pixels stop once their noise is low enough.
+  // pinhole camera, coherent camera rays
+  adaptive_options aopt;
+  aopt.max_spp = ns;
+  adaptive_sampler adaptive(cam, world, black_background, lights, aopt, nx, ny);
 
-      // Gamma correction with gamma=2
-      colorx = vec3( sqrt(colorx[0]), sqrt(colorx[1]), sqrt(colorx[2]) );
-      int ir = static_cast<int>(255.99 * colorx[0]);
-      int ig = static_cast<int>(255.99 * colorx[1]);
-      int ib = static_cast<int>(255.99 * colorx[2]);
+  // render in passes until every pixel is done, or for argv[1] seconds.
+  // a killed run resumes from the checkpoint.
+  progressive_options opt;
+  opt.target_spp = ns;
+  opt.time_budget = argc > 1 ? atof(argv[1]) : 0;
+  opt.checkpoint = "cornell_box_volumes.ckpt";
+  opt.key = hash_key(checkpoint_key(cam, "cornell_box_volumes"), aopt);
 
-      std::cout << ir << " " << ig << " " << ib << "\n";
-    }
-  }
+  framebuffer fb(nx, ny);
+  render_progressive(fb, [&](framebuffer& f, int n) { adaptive(f, n); }, opt);
+  adaptive.report(fb, std::cerr);
+  write_ppm(stdout, fb);
 }
@@ -0,0 +1,200 @@
+#ifndef __DENOISEH__
+#define __DENOISEH__
+/*
+denoise().
+an edge-avoiding a-trous wavelet filter (dammertz et al. 2010) with
+the variance guided luminance weight of svgf (schied et al. 2017).
+every pass is a 5x5 b3-spline kernel with holes 1, 2, 4, 8, ... pixels
+apart, a tap only counts as much as the first hit features (normal,
+depth) and the luminance of the two pixels agree. the luminance may
+differ by a few standard deviations of the pixel mean, which comes
+from the squared sample luminance, and is filtered along.
+
+the color is divided by the first hit albedo before filtering and
+multiplied back after, so textures stay sharp and only the lighting
+is smoothed. the planes are kept SoA, the rows of a pass run on the
+render pool.
+ */
+
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include "render.h"
+
+struct denoise_options {
+  denoise_options()
+    : iterations(5), sigma_luminance(4), sigma_normal(128), sigma_depth(1), demodulate(true) {}
+
+  // the last pass has holes 2^(iterations-1) pixels apart
+  int iterations;
+  // in standard deviations of the pixel mean
+  float sigma_luminance;
+  // exponent of the cosine between the normals
+  float sigma_normal;
+  // in steps of the depth gradient
+  float sigma_depth;
+  // filter the color over the albedo
+  bool demodulate;
+};
+
+class atrous_filter {
+ public:
+  atrous_filter(const framebuffer& fb, const denoise_options& o);
+  // one pass with holes step pixels apart
+  void pass(int step);
+  // the filtered image, one sample per pixel
+  framebuffer result() const;
+
+ private:
+  float normal_exponent(int p, int q) const;
+
+  int nx, ny;
+  denoise_options opt;
+  const framebuffer& source;
+  // the planes of the color (or lighting) and its variance, filtered
+  std::vector<float> c[3], var;
+  // the planes of the features, fixed
+  std::vector<float> albedo[3], normal[3], depth, dzdx, dzdy;
+};
+
+atrous_filter::atrous_filter(const framebuffer& fb, const denoise_options& o)
+  : nx(fb.nx), ny(fb.ny), opt(o), source(fb) {
+  int n = nx*ny;
+  for (int k = 0; k < 3; k++) {
+    c[k].resize(n);
+    albedo[k].resize(n);
+    normal[k].resize(n);
+  }
+  var.resize(n);
+  depth.resize(n);
+  dzdx.resize(n);
+  dzdy.resize(n);
+  for (int p = 0; p < n; p++) {
+    int m = fb.feature_count[p];
+    float inv = m > 0 ? 1.0f / m : 0;
+    vec3 a = m > 0 ? fb.albedo[p] * inv : vec3(1, 1, 1);
+    vec3 nrm = fb.normal[p] * inv;
+    // averaged normals of an edge pixel are shorter than 1
+    if (nrm.squared_length() > 0) nrm.make_unit_vector();
+    vec3 color = fb.count[p] > 0 ? fb.sum[p] / static_cast<float>(fb.count[p]) : vec3(0, 0, 0);
+    float l = luminance(color);
+    // the variance of the sample luminance, over m for the mean's
+    float v = m > 1 ? std::max(fb.moment[p] * inv - l*l, 0.0f) / m : 0;
+    if (opt.demodulate) {
+      for (int k = 0; k < 3; k++) color[k] /= std::max(a[k], 1e-3f);
+      float la = std::max(luminance(a), 1e-3f);
+      v /= la*la;
+    }
+    for (int k = 0; k < 3; k++) {
+      c[k][p] = color[k];
+      albedo[k][p] = a[k];
+      normal[k][p] = nrm[k];
+    }
+    var[p] = v;
+    depth[p] = m > 0 ? fb.depth[p] * inv : 0;
+  }
+  // the smaller one sided difference, an edge does not count as slope
+  auto slope = [&](int p, int q0, int q1) {
+    float d0 = depth[p] - depth[q0], d1 = depth[q1] - depth[p];
+    return std::fabs(d0) < std::fabs(d1) ? d0 : d1;
+  };
+  for (int j = 0; j < ny; j++) {
+    for (int i = 0; i < nx; i++) {
+      int p = j*nx + i;
+      dzdx[p] = slope(p, i > 0 ? p - 1 : p, i < nx-1 ? p + 1 : p);
+      dzdy[p] = slope(p, j > 0 ? p - nx : p, j < ny-1 ? p + nx : p);
+    }
+  }
+}
+
+// the log of the normal weight cos^sigma_normal, taken as
+// -sigma_normal (1 - cos), which saves a log per tap. misses and media
+// have no normal, they only go with each other.
+float atrous_filter::normal_exponent(int p, int q) const {
+  float d = normal[0][p]*normal[0][q] + normal[1][p]*normal[1][q] + normal[2][p]*normal[2][q];
+  bool none_p = normal[0][p] == 0 && normal[1][p] == 0 && normal[2][p] == 0;
+  bool none_q = normal[0][q] == 0 && normal[1][q] == 0 && normal[2][q] == 0;
+  if (none_p || none_q) return none_p == none_q ? 0 : -INFINITY;
+  return d > 0 ? opt.sigma_normal * (d - 1) : -INFINITY;
+}
+
+void atrous_filter::pass(int step) {
+  static const float kernel[5] = { 1.0f/16, 1.0f/4, 3.0f/8, 1.0f/4, 1.0f/16 };
+  static const float gauss[3] = { 0.25f, 0.5f, 0.25f };
+  int n = nx*ny;
+  std::vector<float> out[3], out_var(n);
+  for (int k = 0; k < 3; k++) out[k].resize(n);
+
+  render_pool().parallel_for(ny, [&](int j) {
+    for (int i = 0; i < nx; i++) {
+      int p = j*nx + i;
+      // the variance 3x3 blurred, one pixel's estimate is noisy itself
+      float gv = 0, gw = 0;
+      for (int y = -1; y <= 1; y++) {
+        for (int x = -1; x <= 1; x++) {
+          int yy = j + y, xx = i + x;
+          if (yy < 0 || yy >= ny || xx < 0 || xx >= nx) continue;
+          float w = gauss[x+1] * gauss[y+1];
+          gv += w * var[yy*nx + xx];
+          gw += w;
+        }
+      }
+      float lp = 0.2126f*c[0][p] + 0.7152f*c[1][p] + 0.0722f*c[2][p];
+      float luminance_scale = 1 / (opt.sigma_luminance * std::sqrt(gv / gw) + 1e-6f);
+      float gx = dzdx[p] * step, gy = dzdy[p] * step;
+      // a depth step of one in a thousand passes on a flat wall
+      float depth_floor = 1e-3f * depth[p] + 1e-6f;
+
+      float sum[3] = { 0, 0, 0 }, sum_var = 0, sum_w = 0;
+      for (int y = -2; y <= 2; y++) {
+        int yy = j + y*step;
+        if (yy < 0 || yy >= ny) continue;
+        for (int x = -2; x <= 2; x++) {
+          int xx = i + x*step;
+          if (xx < 0 || xx >= nx) continue;
+          int q = yy*nx + xx;
+          float lq = 0.2126f*c[0][q] + 0.7152f*c[1][q] + 0.0722f*c[2][q];
+          // the three weights multiply, their exponents add
+          float e = normal_exponent(p, q) - std::fabs(lp - lq) * luminance_scale
+                    - std::fabs(depth[p] - depth[q]) /
+                      (opt.sigma_depth * std::fabs(gx*x + gy*y) + depth_floor);
+          float w = kernel[x+2] * kernel[y+2] * std::exp(e);
+          for (int k = 0; k < 3; k++) sum[k] += w * c[k][q];
+          sum_var += w*w * var[q];
+          sum_w += w;
+        }
+      }
+      // the center tap always counts, sum_w > 0
+      for (int k = 0; k < 3; k++) out[k][p] = sum[k] / sum_w;
+      out_var[p] = sum_var / (sum_w*sum_w);
+    }
+  });
+  for (int k = 0; k < 3; k++) c[k].swap(out[k]);
+  var.swap(out_var);
+}
+
+framebuffer atrous_filter::result() const {
+  framebuffer fb(nx, ny);
+  for (int p = 0; p < nx*ny; p++) {
+    vec3 color(c[0][p], c[1][p], c[2][p]);
+    if (opt.demodulate)
+      for (int k = 0; k < 3; k++) color[k] *= std::max(albedo[k][p], 1e-3f);
+    fb.sum[p] = color;
+    fb.count[p] = source.count[p] > 0 ? 1 : 0;
+  }
+  return fb;
+}
+
+// needs the features, keep_features() before rendering. without them
+// the image is returned as it is.
+framebuffer denoise(const framebuffer& fb, const denoise_options& opt = denoise_options()) {
+  if (!fb.has_features()) {
+    std::cerr << "denoise: the framebuffer has no features, call keep_features() first\n";
+    return fb;
+  }
+  atrous_filter filter(fb, opt);
+  for (int i = 0; i < opt.iterations; i++) filter.pass(1 << i);
+  return filter.result();
+}
+
+#endif
@@ -8,6 +8,7 @@
 #include <cfloat>
 #include "ray.h"
 #include "aabb.h"
+#include "ray_packet.h"
 class material;
 
 struct hit_record {
@@ -17,14 +18,52 @@ struct hit_record {
   vec3 p;
   vec3 normal;
   material* mat_ptr;
+  // uv per unit length on the surface around p (the square root of
+  // uv area over surface area), 0 where a shape does not know it
+  float uv_scale = 0;
+  // width of the ray's footprint in uv, set by the integrator.
+  // 0 asks textures for their finest level.
+  float footprint = 0;
 };
 
 class hitable {
  public:
   virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const = 0;
   virtual bool bounding_box(float t0, float t1, aabb& box) const = 0;
+  // the active lanes of p with a hit closer than their t_max,
+  // for those lanes t_max and rec are updated
+  virtual int hit_packet(const ray_packet& p, int active, float t_min,
+                         float* t_max, hit_record* rec) const;
+  // light sampling: the solid angle density, seen from o, of the
+  // directions random(o) returns. 0 for shapes that cannot be sampled.
+  virtual float pdf_value(const vec3& o, const vec3& v) const {
+    return 0.;
+  }
+  virtual vec3 random(const vec3& o) const {
+    return vec3(1., 0., 0.);
+  }
 };
 
+// one lane after another, each drawing from its own random stream
+int hitable::hit_packet(const ray_packet& p, int active, float t_min,
+                        float* t_max, hit_record* rec) const {
+  int mask = 0;
+  hit_record temp_rec;
+  sampler saved = thread_sampler();
+  for (int k = 0; k < packet_size; k++) {
+    if (!(active & (1 << k))) continue;
+    if (p.streams) thread_sampler() = p.streams[k];
+    if (hit(p.r[k], t_min, t_max[k], temp_rec)) {
+      t_max[k] = temp_rec.t;
+      rec[k] = temp_rec;
+      mask |= 1 << k;
+    }
+    if (p.streams) p.streams[k] = thread_sampler();
+  }
+  thread_sampler() = saved;
+  return mask;
+}
+
 class flip_normals : public hitable {
  public:
   flip_normals(hitable* p) : ptr(p) {}
@@ -41,6 +80,21 @@ class flip_normals : public hitable {
     return ptr->bounding_box(t0, t1, box);
   }
 
+  virtual int hit_packet(const ray_packet& p, int active, float t_min,
+                         float* t_max, hit_record* rec) const {
+    int mask = ptr->hit_packet(p, active, t_min, t_max, rec);
+    for (int k = 0; k < packet_size; k++)
+      if (mask & (1 << k)) rec[k].normal = -rec[k].normal;
+    return mask;
+  }
+
+  virtual float pdf_value(const vec3& o, const vec3& v) const {
+    return ptr->pdf_value(o, v);
+  }
+  virtual vec3 random(const vec3& o) const {
+    return ptr->random(o);
+  }
+
   hitable* ptr;
 };
 
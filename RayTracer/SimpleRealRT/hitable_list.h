@@ -5,7 +5,9 @@ Class hitable_list.
 A list of hitable objects.
  */
 
+#include <algorithm>
 #include "hitable.h"
+#include "sampler.h"
 
 class hitable_list: public hitable {
  public:
@@ -13,6 +15,10 @@ class hitable_list: public hitable {
   hitable_list(hitable **l, int n) { list = l; list_size = n; }
   virtual bool hit(const ray &r, float tmin, float tmax, hit_record &rec) const;
   virtual bool bounding_box(float t0, float t1, aabb& box) const;
+  virtual int hit_packet(const ray_packet& p, int active, float t_min,
+                         float* t_max, hit_record* rec) const;
+  virtual float pdf_value(const vec3& o, const vec3& v) const;
+  virtual vec3 random(const vec3& o) const;
   // array of pointer
   hitable **list;
   int list_size;
@@ -53,4 +59,26 @@ bool hitable_list::hit(const ray &r, float t_min, float t_max, hit_record &rec)
   return hit_anything;
 }
 
+// every hit lowers t_max of its lane, so the closest one is kept
+int hitable_list::hit_packet(const ray_packet& p, int active, float t_min,
+                             float* t_max, hit_record* rec) const {
+  int mask = 0;
+  for (int i = 0; i < list_size; i++)
+    mask |= list[i]->hit_packet(p, active, t_min, t_max, rec);
+  return mask;
+}
+
+// picks one of the shapes uniformly, the density is their mean
+float hitable_list::pdf_value(const vec3& o, const vec3& v) const {
+  float sum = 0;
+  for (int i = 0; i < list_size; i++)
+    sum += list[i]->pdf_value(o, v);
+  return sum / list_size;
+}
+
+vec3 hitable_list::random(const vec3& o) const {
+  int index = std::min(static_cast<int>(random_float() * list_size), list_size - 1);
+  return list[index]->random(o);
+}
+
 #endif
@@ -0,0 +1,429 @@
+#ifndef __IMAGEIOH__
+#define __IMAGEIOH__
+/*
+image output.
+writes a float image as binary ppm (P6), pfm, png or uncompressed
+openexr. the whole file is encoded into one byte buffer first and
+written with a single fwrite.
+no dependencies besides the standard library, the rasterizer includes
+this file too.
+
+images are width * height pixels of `channels` interleaved floats,
+the top row first. ppm and png take the first three channels (one
+channel is written as gray) in [0, 1] and encode them with 1/gamma;
+pfm and exr store the floats as they are.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+typedef std::vector<unsigned char> byte_buffer;
+
+inline void put_bytes(byte_buffer& out, const void* p, size_t n) {
+  const unsigned char* b = static_cast<const unsigned char*>(p);
+  out.insert(out.end(), b, b + n);
+}
+
+inline void put_string(byte_buffer& out, const std::string& s) {
+  put_bytes(out, s.data(), s.size());
+}
+
+// little endian, whatever the host is
+inline void put_u32le(byte_buffer& out, uint32_t v) {
+  for (int k = 0; k < 4; k++) out.push_back((v >> (8*k)) & 0xff);
+}
+
+inline void put_u64le(byte_buffer& out, uint64_t v) {
+  for (int k = 0; k < 8; k++) out.push_back((v >> (8*k)) & 0xff);
+}
+
+inline void put_f32le(byte_buffer& out, float f) {
+  uint32_t v;
+  memcpy(&v, &f, 4);
+  put_u32le(out, v);
+}
+
+inline void put_u32be(byte_buffer& out, uint32_t v) {
+  for (int k = 3; k >= 0; k--) out.push_back((v >> (8*k)) & 0xff);
+}
+
+// one channel to 8 bit, nan and negative values become 0
+inline unsigned char to_byte(float v, float gamma) {
+  if (!(v > 0)) return 0;
+  double d = v;
+  if (gamma == 2) d = std::sqrt(d);
+  else if (gamma != 1) d = std::pow(d, 1.0 / gamma);
+  return static_cast<unsigned char>(std::min(static_cast<int>(255.99 * d), 255));
+}
+
+// channel k of pixel p, gray images repeat their only channel
+inline float channel(const float* data, int channels, int p, int k) {
+  return data[p*channels + std::min(k, channels-1)];
+}
+
+byte_buffer encode_ppm(const float* data, int w, int h, int channels, float gamma = 1) {
+  byte_buffer out;
+  put_string(out, "P6\n" + std::to_string(w) + " " + std::to_string(h) + "\n255\n");
+  size_t header = out.size();
+  out.resize(header + 3*size_t(w)*h);
+  unsigned char* px = out.data() + header;
+  for (int p = 0; p < w*h; p++)
+    for (int k = 0; k < 3; k++)
+      *px++ = to_byte(channel(data, channels, p, k), gamma);
+  return out;
+}
+
+// pfm keeps the bottom row first, a negative scale means little endian
+byte_buffer encode_pfm(const float* data, int w, int h, int channels) {
+  byte_buffer out;
+  put_string(out, "PF\n" + std::to_string(w) + " " + std::to_string(h) + "\n-1.0\n");
+  out.reserve(out.size() + 12*size_t(w)*h);
+  for (int j = h-1; j >= 0; j--)
+    for (int i = 0; i < w; i++)
+      for (int k = 0; k < 3; k++)
+        put_f32le(out, channel(data, channels, j*w + i, k));
+  return out;
+}
+
+uint32_t crc32(const unsigned char* p, size_t n, uint32_t crc = 0) {
+  static uint32_t table[256];
+  static bool ready = false;
+  if (!ready) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      table[i] = c;
+    }
+    ready = true;
+  }
+  crc = ~crc;
+  for (size_t i = 0; i < n; i++) crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+uint32_t adler32(const unsigned char* p, size_t n) {
+  uint32_t a = 1, b = 0;
+  while (n > 0) {
+    // the sums cannot overflow within 5552 bytes
+    size_t block = std::min(n, size_t(5552));
+    for (size_t i = 0; i < block; i++) {
+      a += p[i];
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+    p += block;
+    n -= block;
+  }
+  return (b << 16) | a;
+}
+
+// deflate with the fixed huffman codes and a hash chain lz77 matcher
+class deflate_writer {
+ public:
+  deflate_writer(byte_buffer& o) : out(o), bits(0), nbits(0) {}
+
+  void compress(const unsigned char* data, size_t n);
+
+ private:
+  // lsb first, as deflate packs everything but the huffman codes
+  void put_bits(uint32_t v, int n) {
+    bits |= v << nbits;
+    nbits += n;
+    while (nbits >= 8) {
+      out.push_back(bits & 0xff);
+      bits >>= 8;
+      nbits -= 8;
+    }
+  }
+  // huffman codes go msb first
+  void put_code(uint32_t code, int n) {
+    uint32_t r = 0;
+    for (int k = 0; k < n; k++) r |= ((code >> k) & 1) << (n-1-k);
+    put_bits(r, n);
+  }
+  void flush() {
+    if (nbits > 0) out.push_back(bits & 0xff);
+    bits = 0;
+    nbits = 0;
+  }
+  void literal(int v);
+  void match(int length, int distance);
+
+  byte_buffer& out;
+  uint32_t bits;
+  int nbits;
+};
+
+void deflate_writer::literal(int v) {
+  if (v < 144) put_code(0x30 + v, 8);
+  else if (v < 256) put_code(0x190 + v - 144, 9);
+  else if (v < 280) put_code(v - 256, 7);
+  else put_code(0xc0 + v - 280, 8);
+}
+
+void deflate_writer::match(int length, int distance) {
+  static const int length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+  static const int length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+  static const int dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+  static const int dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+  int l = 28;
+  while (length_base[l] > length) l--;
+  literal(257 + l);
+  put_bits(length - length_base[l], length_extra[l]);
+  int d = 29;
+  while (dist_base[d] > distance) d--;
+  put_code(d, 5);
+  put_bits(distance - dist_base[d], dist_extra[d]);
+}
+
+void deflate_writer::compress(const unsigned char* data, size_t n) {
+  const int window = 32768;
+  const int hash_size = 1 << 15;
+  const int max_chain = 32;
+  std::vector<int> head(hash_size, -1);
+  std::vector<int> prev(window, -1);
+  // a single final block with fixed codes
+  put_bits(1, 1);
+  put_bits(1, 2);
+  size_t i = 0;
+  while (i < n) {
+    int best_len = 0, best_dist = 0;
+    if (i + 3 <= n) {
+      uint32_t h = ((data[i] << 16) | (data[i+1] << 8) | data[i+2]) * 2654435761u >> 17;
+      size_t max_len = std::min(n - i, size_t(258));
+      int chain = max_chain;
+      for (int c = head[h]; c >= 0 && i - c <= size_t(window) && chain-- > 0; c = prev[c % window]) {
+        size_t len = 0;
+        while (len < max_len && data[c + len] == data[i + len]) len++;
+        if (static_cast<int>(len) > best_len) {
+          best_len = static_cast<int>(len);
+          best_dist = static_cast<int>(i - c);
+          if (len == max_len) break;
+        }
+      }
+      prev[i % window] = head[h];
+      head[h] = static_cast<int>(i);
+    }
+    if (best_len >= 3) {
+      match(best_len, best_dist);
+      // the skipped positions still go into the hash chains
+      for (size_t k = i + 1; k < i + best_len && k + 3 <= n; k++) {
+        uint32_t h = ((data[k] << 16) | (data[k+1] << 8) | data[k+2]) * 2654435761u >> 17;
+        prev[k % window] = head[h];
+        head[h] = static_cast<int>(k);
+      }
+      i += best_len;
+    } else {
+      literal(data[i]);
+      i++;
+    }
+  }
+  literal(256);
+  flush();
+}
+
+inline int paeth(int a, int b, int c) {
+  int p = a + b - c;
+  int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+  if (pa <= pb && pa <= pc) return a;
+  return pb <= pc ? b : c;
+}
+
+static void png_chunk(byte_buffer& out, const char* type, const byte_buffer& payload) {
+  put_u32be(out, static_cast<uint32_t>(payload.size()));
+  size_t start = out.size();
+  put_bytes(out, type, 4);
+  put_bytes(out, payload.data(), payload.size());
+  put_u32be(out, crc32(out.data() + start, out.size() - start));
+}
+
+// 8 bit rgb. every row takes the filter with the smallest sum of
+// absolute differences, then the lot is deflated in one zlib stream.
+byte_buffer encode_png(const float* data, int w, int h, int channels, float gamma = 1) {
+  size_t stride = 3*size_t(w);
+  std::vector<unsigned char> rgb(stride*h);
+  for (int p = 0; p < w*h; p++)
+    for (int k = 0; k < 3; k++)
+      rgb[3*p + k] = to_byte(channel(data, channels, p, k), gamma);
+
+  std::vector<unsigned char> filtered((stride+1)*h);
+  std::vector<unsigned char> row(stride);
+  for (int j = 0; j < h; j++) {
+    const unsigned char* cur = &rgb[j*stride];
+    const unsigned char* up = j > 0 ? &rgb[(j-1)*stride] : nullptr;
+    long best_sum = -1;
+    for (int f = 0; f < 5; f++) {
+      long sum = 0;
+      for (size_t i = 0; i < stride; i++) {
+        int a = i >= 3 ? cur[i-3] : 0;
+        int b = up ? up[i] : 0;
+        int c = (up && i >= 3) ? up[i-3] : 0;
+        int pred = 0;
+        switch (f) {
+          case 1: pred = a; break;
+          case 2: pred = b; break;
+          case 3: pred = (a + b) / 2; break;
+          case 4: pred = paeth(a, b, c); break;
+        }
+        row[i] = static_cast<unsigned char>(cur[i] - pred);
+        // residuals as signed bytes
+        sum += std::abs(static_cast<signed char>(row[i]));
+      }
+      if (best_sum < 0 || sum < best_sum) {
+        best_sum = sum;
+        filtered[j*(stride+1)] = static_cast<unsigned char>(f);
+        std::copy(row.begin(), row.end(), filtered.begin() + j*(stride+1) + 1);
+      }
+    }
+  }
+
+  byte_buffer out;
+  const unsigned char signature[8] = { 137, 'P', 'N', 'G', 13, 10, 26, 10 };
+  put_bytes(out, signature, 8);
+
+  byte_buffer ihdr;
+  put_u32be(ihdr, w);
+  put_u32be(ihdr, h);
+  // 8 bit, truecolor, deflate, adaptive filters, no interlace
+  const unsigned char format[5] = { 8, 2, 0, 0, 0 };
+  put_bytes(ihdr, format, 5);
+  png_chunk(out, "IHDR", ihdr);
+
+  byte_buffer idat;
+  // zlib header: deflate with a 32k window, no dictionary
+  idat.push_back(0x78);
+  idat.push_back(0x01);
+  deflate_writer(idat).compress(filtered.data(), filtered.size());
+  put_u32be(idat, adler32(filtered.data(), filtered.size()));
+  png_chunk(out, "IDAT", idat);
+  png_chunk(out, "IEND", byte_buffer());
+  return out;
+}
+
+static void exr_attribute(byte_buffer& out, const char* name, const char* type,
+                          const byte_buffer& value) {
+  put_bytes(out, name, strlen(name) + 1);
+  put_bytes(out, type, strlen(type) + 1);
+  put_u32le(out, static_cast<uint32_t>(value.size()));
+  put_bytes(out, value.data(), value.size());
+}
+
+// scanline exr, no compression, 32 bit float channels.
+// names default to R, G, B (and A) for 3 or 4 channels.
+byte_buffer encode_exr(const float* data, int w, int h, int channels,
+                       const char* const* names = nullptr) {
+  static const char* const rgba[4] = { "R", "G", "B", "A" };
+  std::vector<std::string> name(channels);
+  for (int k = 0; k < channels; k++)
+    name[k] = names ? names[k] : (channels <= 4 ? rgba[k] : "C" + std::to_string(k));
+  // exr lists the channels sorted by name, pixel data follows that order
+  std::vector<int> order(channels);
+  for (int k = 0; k < channels; k++) order[k] = k;
+  std::sort(order.begin(), order.end(), [&](int a, int b) { return name[a] < name[b]; });
+
+  byte_buffer out;
+  put_u32le(out, 20000630);
+  // version 2, single part scanline
+  put_u32le(out, 2);
+
+  byte_buffer v;
+  for (int k = 0; k < channels; k++) {
+    put_string(v, name[order[k]]);
+    v.push_back(0);
+    // pixel type float, plinear, reserved, x/y sampling
+    put_u32le(v, 2);
+    put_u32le(v, 0);
+    put_u32le(v, 1);
+    put_u32le(v, 1);
+  }
+  v.push_back(0);
+  exr_attribute(out, "channels", "chlist", v);
+  exr_attribute(out, "compression", "compression", byte_buffer(1, 0));
+  v.clear();
+  put_u32le(v, 0);
+  put_u32le(v, 0);
+  put_u32le(v, w-1);
+  put_u32le(v, h-1);
+  exr_attribute(out, "dataWindow", "box2i", v);
+  exr_attribute(out, "displayWindow", "box2i", v);
+  // increasing y
+  exr_attribute(out, "lineOrder", "lineOrder", byte_buffer(1, 0));
+  v.clear();
+  put_f32le(v, 1);
+  exr_attribute(out, "pixelAspectRatio", "float", v);
+  v.clear();
+  put_f32le(v, 0);
+  put_f32le(v, 0);
+  exr_attribute(out, "screenWindowCenter", "v2f", v);
+  v.clear();
+  put_f32le(v, 1);
+  exr_attribute(out, "screenWindowWidth", "float", v);
+  out.push_back(0);
+
+  // offset table, one scanline per block
+  uint32_t line_size = 4 * channels * w;
+  uint64_t offset = out.size() + 8*size_t(h);
+  for (int j = 0; j < h; j++) {
+    put_u64le(out, offset);
+    offset += 8 + line_size;
+  }
+  out.reserve(offset);
+  for (int j = 0; j < h; j++) {
+    put_u32le(out, j);
+    put_u32le(out, line_size);
+    // all of one channel, then the next
+    for (int k = 0; k < channels; k++)
+      for (int i = 0; i < w; i++)
+        put_f32le(out, data[(j*w + i)*channels + order[k]]);
+  }
+  return out;
+}
+
+bool write_bytes(FILE* f, const byte_buffer& bytes) {
+  return fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size() && fflush(f) == 0;
+}
+
+// the format follows the extension of path: .ppm, .pfm, .png or .exr.
+// gamma only applies to the 8 bit formats.
+bool write_image(const char* path, const float* data, int w, int h, int channels,
+                 float gamma = 1) {
+  std::string p(path);
+  std::string ext = p.substr(std::min(p.size(), p.rfind('.') + 1));
+  std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+  byte_buffer bytes;
+  if (ext == "ppm") bytes = encode_ppm(data, w, h, channels, gamma);
+  else if (ext == "pfm") bytes = encode_pfm(data, w, h, channels);
+  else if (ext == "png") bytes = encode_png(data, w, h, channels, gamma);
+  else if (ext == "exr") bytes = encode_exr(data, w, h, channels);
+  else {
+    std::cerr << "unknown image format " << path << "\n";
+    return false;
+  }
+  FILE* f = fopen(path, "wb");
+  if (!f) {
+    std::cerr << "cannot write " << path << "\n";
+    return false;
+  }
+  bool ok = write_bytes(f, bytes);
+  ok = (fclose(f) == 0) && ok;
+  if (!ok) std::cerr << "cannot write " << path << "\n";
+  return ok;
+}
+
+#endif
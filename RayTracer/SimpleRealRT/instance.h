@@ -0,0 +1,193 @@
+#ifndef __INSTANCEH__
+#define __INSTANCEH__
+/*
+class affine, class instance.
+an instance places a shared hitable in the world with a 3x4 affine
+matrix. the inverse matrix and the world bounds are computed once, a
+hit maps the ray into object space, asks the shared hitable, and maps
+the point and normal back. any number of instances can share one
+hitable (e.g. a mesh with its own bvh), the geometry is stored once.
+ */
+
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+#include "hitable.h"
+
+// world = m * (object, 1), rows of the 3x3 part and the translation
+class affine {
+ public:
+  affine() {
+    for (int i = 0; i < 3; i++)
+      for (int j = 0; j < 4; j++)
+        m[i][j] = i == j ? 1 : 0;
+  }
+
+  static affine translation(const vec3& t);
+  static affine scaling(const vec3& s);
+  // right handed, around a unit axis through the origin
+  static affine rotation(const vec3& axis, float degrees);
+  static affine rotation_y(float degrees) { return rotation(vec3(0, 1, 0), degrees); }
+
+  // apply b first, then this
+  affine operator*(const affine& b) const;
+  affine inverse() const;
+  // of the 3x3 part, the volume scale
+  float determinant() const {
+    return m[0][0]*(m[1][1]*m[2][2] - m[1][2]*m[2][1]) -
+           m[0][1]*(m[1][0]*m[2][2] - m[1][2]*m[2][0]) +
+           m[0][2]*(m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+  }
+
+  vec3 point(const vec3& p) const {
+    return vec3(m[0][0]*p[0] + m[0][1]*p[1] + m[0][2]*p[2] + m[0][3],
+                m[1][0]*p[0] + m[1][1]*p[1] + m[1][2]*p[2] + m[1][3],
+                m[2][0]*p[0] + m[2][1]*p[1] + m[2][2]*p[2] + m[2][3]);
+  }
+  vec3 vector(const vec3& v) const {
+    return vec3(m[0][0]*v[0] + m[0][1]*v[1] + m[0][2]*v[2],
+                m[1][0]*v[0] + m[1][1]*v[1] + m[1][2]*v[2],
+                m[2][0]*v[0] + m[2][1]*v[1] + m[2][2]*v[2]);
+  }
+  // by the transpose, normals go with the transpose of the inverse
+  vec3 transposed(const vec3& v) const {
+    return vec3(m[0][0]*v[0] + m[1][0]*v[1] + m[2][0]*v[2],
+                m[0][1]*v[0] + m[1][1]*v[1] + m[2][1]*v[2],
+                m[0][2]*v[0] + m[1][2]*v[1] + m[2][2]*v[2]);
+  }
+
+  float m[3][4];
+};
+
+affine affine::translation(const vec3& t) {
+  affine a;
+  for (int i = 0; i < 3; i++) a.m[i][3] = t[i];
+  return a;
+}
+
+affine affine::scaling(const vec3& s) {
+  affine a;
+  for (int i = 0; i < 3; i++) a.m[i][i] = s[i];
+  return a;
+}
+
+// rodrigues: cos I + sin [k]x + (1 - cos) k k^T
+affine affine::rotation(const vec3& axis, float degrees) {
+  float radians = (M_PI / 180.) * degrees;
+  float c = cos(radians), s = sin(radians);
+  vec3 k = unit_vector(axis);
+  float cross[3][3] = { {     0, -k[2],  k[1] },
+                        {  k[2],     0, -k[0] },
+                        { -k[1],  k[0],     0 } };
+  affine a;
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+      a.m[i][j] = (i == j ? c : 0) + s*cross[i][j] + (1 - c)*k[i]*k[j];
+  return a;
+}
+
+affine affine::operator*(const affine& b) const {
+  affine r;
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 4; j++) {
+      r.m[i][j] = m[i][0]*b.m[0][j] + m[i][1]*b.m[1][j] + m[i][2]*b.m[2][j];
+      if (j == 3) r.m[i][j] += m[i][3];
+    }
+  }
+  return r;
+}
+
+// the 3x3 part by its adjugate, then the translation undone
+affine affine::inverse() const {
+  float c[3][3];
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      int i1 = (i+1) % 3, i2 = (i+2) % 3;
+      int j1 = (j+1) % 3, j2 = (j+2) % 3;
+      // cofactor of (j, i), the cyclic order takes care of the sign
+      c[i][j] = m[j1][i1]*m[j2][i2] - m[j1][i2]*m[j2][i1];
+    }
+  }
+  float det = m[0][0]*c[0][0] + m[0][1]*c[1][0] + m[0][2]*c[2][0];
+  if (det == 0) std::cerr << "singular transform in affine::inverse\n";
+  affine r;
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+      r.m[i][j] = c[i][j] / det;
+  for (int i = 0; i < 3; i++)
+    r.m[i][3] = -(r.m[i][0]*m[0][3] + r.m[i][1]*m[1][3] + r.m[i][2]*m[2][3]);
+  return r;
+}
+
+class instance : public hitable {
+ public:
+  instance(hitable* p, const affine& object_to_world);
+  virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+  virtual bool bounding_box(float t0, float t1, aabb& box) const {
+    box = bbox;
+    return hasbox;
+  }
+  virtual int hit_packet(const ray_packet& p, int active, float t_min,
+                         float* t_max, hit_record* rec) const;
+
+  hitable* ptr;
+  affine to_world;
+  affine to_object;
+  // the mean length scale of to_world, for uv_scale
+  float scale;
+  bool hasbox;
+  aabb bbox;
+
+ private:
+  // the direction is not normalized, t is the same in both spaces
+  ray object_ray(const ray& r) const {
+    return ray(to_object.point(r.origin()), to_object.vector(r.direction()), r.time());
+  }
+  void world_record(const ray& r, hit_record& rec) const {
+    rec.p = r.point_at_parameter(rec.t);
+    rec.normal = unit_vector(to_object.transposed(rec.normal));
+    rec.uv_scale /= scale;
+  }
+};
+
+// the world box around the 8 transformed corners
+instance::instance(hitable* p, const affine& object_to_world)
+  : ptr(p), to_world(object_to_world), to_object(object_to_world.inverse()),
+    scale(cbrt(fabs(object_to_world.determinant()))) {
+  aabb box;
+  hasbox = ptr->bounding_box(0, 1, box);
+  if (!hasbox) return;
+  vec3 min(FLT_MAX, FLT_MAX, FLT_MAX);
+  vec3 max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+  for (int k = 0; k < 8; k++) {
+    vec3 corner((k & 1 ? box.max() : box.min()).x(),
+                (k & 2 ? box.max() : box.min()).y(),
+                (k & 4 ? box.max() : box.min()).z());
+    vec3 w = to_world.point(corner);
+    for (int a = 0; a < 3; a++) {
+      min[a] = ffmin(min[a], w[a]);
+      max[a] = ffmax(max[a], w[a]);
+    }
+  }
+  bbox = aabb(min, max);
+}
+
+bool instance::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+  if (!ptr->hit(object_ray(r), t_min, t_max, rec)) return false;
+  world_record(r, rec);
+  return true;
+}
+
+int instance::hit_packet(const ray_packet& p, int active, float t_min,
+                         float* t_max, hit_record* rec) const {
+  ray rays[packet_size];
+  for (int k = 0; k < packet_size; k++) rays[k] = object_ray(p.r[k]);
+  ray_packet q(rays, packet_size);
+  q.streams = p.streams;
+  int mask = ptr->hit_packet(q, active, t_min, t_max, rec);
+  for (int k = 0; k < packet_size; k++)
+    if (mask & (1 << k)) world_record(p.r[k], rec[k]);
+  return mask;
+}
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef __INTEGRATORH__
+#define __INTEGRATORH__
+/*
+the iterative path integrator.
+same contract as the recursive color() functions: add what the hit
+material emits, continue along the scattered ray, weighted by the
+bsdf times the cosine over the density it was drawn with (the
+attenuation, for specular materials). the path keeps that weight
+as its throughput instead of recursing, and once the throughput
+drops below 1 it is ended by russian roulette, the surviving paths
+are reweighted to stay unbiased. given the light shapes, diffuse
+hits also sample them directly (next event estimation), combined
+with the scattered rays by MIS.
+ */
+
+#include <cmath>
+#include "hitable.h"
+#include "material.h"
+#include "sampler.h"
+
+// radiance of the rays leaving the scene
+typedef vec3 (*background)(const ray& r);
+
+// no indirect environment light
+vec3 black_background(const ray& r) {
+  return vec3(0., 0., 0.);
+}
+
+vec3 sky_background(const ray& r) {
+  vec3 unit_direction = unit_vector(r.direction());
+  float t = 0.5 * (unit_direction.y() + 1.0);
+  return (1.0-t) * vec3(1.0, 1.0, 1.0) + t * vec3(0.5, 0.7, 1.0);
+}
+
+// power heuristic, the weight of a sample drawn with density f when
+// the other strategy would have drawn it with density g
+inline float mis_weight(float f, float g) {
+  // as a ratio, an infinite density (grazing light samples) stays finite
+  if (f >= g) {
+    float r = g / f;
+    return 1 / (1 + r*r);
+  }
+  float r = f / g;
+  return r*r / (1 + r*r);
+}
+
+// next event estimation: radiance a light sample brings to rec,
+// unweighted by the throughput. 0 when the shadow ray is blocked.
+vec3 sample_light(const ray& r, const hit_record& rec, hitable* world,
+                  const hitable* lights) {
+  ray shadow(rec.p, lights->random(rec.p), r.time());
+  float light_pdf = lights->pdf_value(rec.p, shadow.direction());
+  if (light_pdf <= 0) return vec3(0., 0., 0.);
+  vec3 f = material_eval(rec.mat_ptr, r, rec, shadow.direction());
+  if (f.x() <= 0 && f.y() <= 0 && f.z() <= 0) return vec3(0., 0., 0.);
+
+  // the point on the light, then anything in front of it
+  hit_record light_rec;
+  if (!lights->hit(shadow, 0.001, MAXFLOAT, light_rec)) return vec3(0., 0., 0.);
+  hit_record blocker;
+  if (world->hit(shadow, 0.001, light_rec.t * (1 - 1e-4), blocker)) return vec3(0., 0., 0.);
+
+  vec3 emitted = material_emitted(light_rec.mat_ptr, light_rec.u, light_rec.v, light_rec.p);
+  float bsdf_pdf = material_pdf(rec.mat_ptr, r, rec, shadow.direction());
+  return f * emitted / light_pdf * mis_weight(light_pdf, bsdf_pdf);
+}
+
+// the width in uv of a ray cone of the given width at rec, wider
+// where the surface is seen at a grazing angle
+inline void set_footprint(hit_record& rec, const ray& r, float width) {
+  float cosine = fabs(dot(unit_vector(r.direction()), rec.normal)) / rec.normal.length();
+  rec.footprint = width * rec.uv_scale / ffmax(cosine, 0.1);
+}
+
+// continue a path whose first intersection is known already,
+// found says whether r_in hit anything, and first is that hit.
+// with lights, every non-specular hit also samples them and both
+// strategies are weighted by multiple importance sampling.
+// vertices, when given, gets the number of surfaces the path hit.
+// spread is the angle of the camera ray cone, with it the texture
+// lookups are filtered over the cone's footprint. the cone keeps its
+// spread through the bounces, it only grows with the distance.
+vec3 trace_path(const ray& r_in, bool found, const hit_record& first, hitable* world,
+                background env, const hitable* lights = nullptr,
+                int max_depth = 50, int rr_depth = 3, int* vertices = nullptr,
+                float spread = 0) {
+  vec3 radiance(0., 0., 0.);
+  vec3 throughput(1., 1., 1.);
+  ray r = r_in;
+  hit_record rec = first;
+  // density of the last scatter direction, 0 after a specular bounce
+  float last_pdf = 0;
+  vec3 last_p;
+  // the width of the ray cone at the last hit
+  float width = 0;
+  int depth = 0;
+  for (; ; depth++) {
+    if (depth > 0) found = world->hit(r, 0.001, MAXFLOAT, rec);
+    if (!found) {
+      radiance += throughput * env(r);
+      break;
+    }
+    if (spread > 0) {
+      width += spread * rec.t * r.direction().length();
+      set_footprint(rec, r, width);
+    }
+    vec3 emitted = material_emitted(rec.mat_ptr, rec.u, rec.v, rec.p);
+    bool emits = emitted.x() > 0 || emitted.y() > 0 || emitted.z() > 0;
+    if (emits && last_pdf > 0 && lights) {
+      // the light sample at the last vertex could have found this
+      float light_pdf = lights->pdf_value(last_p, r.direction());
+      radiance += throughput * emitted * mis_weight(last_pdf, light_pdf);
+    } else {
+      radiance += throughput * emitted;
+    }
+
+    bsdf_sample bs;
+    if (depth >= max_depth || !material_sample(rec.mat_ptr, r, rec, bs))
+      break;
+    if (lights && !bs.specular)
+      radiance += throughput * sample_light(r, rec, world, lights);
+    last_pdf = bs.specular ? 0 : bs.pdf;
+    last_p = rec.p;
+    throughput *= bs.specular ? bs.f : bs.f / bs.pdf;
+
+    if (depth >= rr_depth) {
+      float p = ffmax(throughput.x(), ffmax(throughput.y(), throughput.z()));
+      if (p < 1) {
+        if (random_float() >= p) break;
+        throughput /= p;
+      }
+    }
+    r = bs.scattered;
+  }
+  if (vertices) *vertices = found ? depth + 1 : depth;
+  return radiance;
+}
+
+vec3 trace_path(const ray& r_in, hitable* world, background env,
+                const hitable* lights = nullptr, int max_depth = 50, int rr_depth = 3) {
+  hit_record rec;
+  bool found = world->hit(r_in, 0.001, MAXFLOAT, rec);
+  return trace_path(r_in, found, rec, world, env, lights, max_depth, rr_depth);
+}
+
+#endif
@@ -0,0 +1,224 @@
+#ifndef __LINEARBVHH__
+#define __LINEARBVHH__
+/*
+class linear_bvh.
+the SAH bvh flattened into one contiguous array of 32 byte nodes.
+the first child of an interior node is the next node in the array,
+the second child is at node.offset. traversal uses an explicit stack,
+visits the near child first and shrinks t_max with every hit, so far
+subtrees behind a hit are culled by the box test.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+#include "bvh.h"
+
+struct linear_bvh_node {
+  float bmin[3];
+  float bmax[3];
+  // leaf: first primitive, interior: second child
+  int offset;
+  // 0 for interior nodes
+  uint16_t nprims;
+  uint8_t axis;
+  uint8_t pad;
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node should be 32 bytes");
+
+// the node array of any flattened tree, the primitives are left to the owner
+class flat_bvh {
+ public:
+  // prims are reordered, order[k] is the original index of leaf slot k
+  void build(std::vector<bvh_primitive>& prims, int max_leaf);
+
+  // intersect(k, t_min, t_max) tests leaf slot k and on a hit
+  // lowers t_max to the hit distance and returns true.
+  template <class F>
+  bool traverse(const ray& r, float t_min, float t_max, F intersect) const;
+
+  // the same for the active lanes of a packet, intersect(k, mask)
+  // tests leaf slot k for the lanes in mask and returns those it hit
+  template <class F>
+  int traverse_packet(const ray_packet& p, int active, float t_min,
+                      const float* t_max, F intersect) const;
+
+  aabb bounds() const {
+    return aabb(vec3(nodes[0].bmin[0], nodes[0].bmin[1], nodes[0].bmin[2]),
+                vec3(nodes[0].bmax[0], nodes[0].bmax[1], nodes[0].bmax[2]));
+  }
+
+  std::vector<linear_bvh_node> nodes;
+  std::vector<int> order;
+  // the most interior nodes on a path from the root, below bvh_stack_size
+  int depth = 0;
+
+ private:
+  int flatten(bvh_primitive* prims, int n, int max_leaf, int level);
+};
+
+void flat_bvh::build(std::vector<bvh_primitive>& prims, int max_leaf) {
+  nodes.clear();
+  order.clear();
+  depth = 0;
+  if (prims.empty()) return;
+  nodes.reserve(2*prims.size());
+  order.reserve(prims.size());
+  flatten(prims.data(), static_cast<int>(prims.size()), max_leaf, 0);
+}
+
+// depth first, returns the index of the new node. level is the number
+// of interior nodes above it.
+int flat_bvh::flatten(bvh_primitive* prims, int n, int max_leaf, int level) {
+  int index = static_cast<int>(nodes.size());
+  nodes.push_back(linear_bvh_node());
+  aabb box = primitive_bounds(prims, n);
+  for (int a = 0; a < 3; a++) {
+    nodes[index].bmin[a] = box.min()[a];
+    nodes[index].bmax[a] = box.max()[a];
+  }
+  nodes[index].pad = 0;
+
+  if (n <= max_leaf) {
+    nodes[index].offset = static_cast<int>(order.size());
+    nodes[index].nprims = static_cast<uint16_t>(n);
+    nodes[index].axis = 0;
+    for (int i = 0; i < n; i++)
+      order.push_back(prims[i].index);
+  } else {
+    int axis;
+    int mid = level < bvh_sah_depth ? sah_split(prims, n, &axis) : median_split(prims, n, &axis);
+    depth = std::max(depth, level + 1);
+    flatten(prims, mid, max_leaf, level + 1);
+    int second = flatten(prims + mid, n - mid, max_leaf, level + 1);
+    // nodes may have moved, index again
+    nodes[index].offset = second;
+    nodes[index].nprims = 0;
+    nodes[index].axis = static_cast<uint8_t>(axis);
+  }
+  return index;
+}
+
+template <class F>
+bool flat_bvh::traverse(const ray& r, float t_min, float t_max, F intersect) const {
+  if (nodes.empty()) return false;
+  const int* neg = r.sign;
+
+  // one entry per level, the builders keep the depth below the size
+  int stack[bvh_stack_size];
+  int sp = 0;
+  int current = 0;
+  bool hit_anything = false;
+  for (;;) {
+    const linear_bvh_node& node = nodes[current];
+    // bmin and bmax are adjacent, as slab_hit wants them
+    if (slab_hit(node.bmin, r, t_min, t_max)) {
+      if (node.nprims > 0) {
+        for (int k = node.offset; k < node.offset + node.nprims; k++) {
+          if (intersect(k, t_min, t_max)) hit_anything = true;
+        }
+      } else {
+        // near child first, the far one waits on the stack
+        assert(sp < bvh_stack_size);
+        if (neg[node.axis]) {
+          stack[sp++] = current + 1;
+          current = node.offset;
+        } else {
+          stack[sp++] = node.offset;
+          current = current + 1;
+        }
+        continue;
+      }
+    }
+    if (sp == 0) break;
+    current = stack[--sp];
+  }
+  return hit_anything;
+}
+
+template <class F>
+int flat_bvh::traverse_packet(const ray_packet& p, int active, float t_min,
+                              const float* t_max, F intersect) const {
+  if (nodes.empty()) return 0;
+  // a node is entered with the lanes that reached its parent
+  int stack_node[bvh_stack_size];
+  int stack_mask[bvh_stack_size];
+  int sp = 0;
+  int current = 0;
+  int mask = active;
+  int hit_mask = 0;
+  for (;;) {
+    const linear_bvh_node& node = nodes[current];
+    int m = packet_slab_hit(node.bmin, p, mask, t_min, t_max);
+    if (m) {
+      if (node.nprims > 0) {
+        for (int k = node.offset; k < node.offset + node.nprims; k++)
+          hit_mask |= intersect(k, m);
+      } else {
+        // near child by the first lane's direction
+        assert(sp < bvh_stack_size);
+        if (p.sign[node.axis]) {
+          stack_node[sp] = current + 1;
+          current = node.offset;
+        } else {
+          stack_node[sp] = node.offset;
+          current = current + 1;
+        }
+        stack_mask[sp++] = m;
+        mask = m;
+        continue;
+      }
+    }
+    if (sp == 0) break;
+    --sp;
+    current = stack_node[sp];
+    mask = stack_mask[sp];
+  }
+  return hit_mask;
+}
+
+class linear_bvh : public hitable {
+ public:
+  linear_bvh() {}
+  linear_bvh(hitable** l, int n, float time0, float time1, int max_leaf = 2);
+  virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+  virtual int hit_packet(const ray_packet& p, int active, float t_min,
+                         float* t_max, hit_record* rec) const {
+    return tree.traverse_packet(p, active, t_min, t_max, [&](int k, int m) {
+      return list[k]->hit_packet(p, m, t_min, t_max, rec);
+    });
+  }
+  virtual bool bounding_box(float t0, float t1, aabb& box) const {
+    if (tree.nodes.empty()) return false;
+    box = tree.bounds();
+    return true;
+  }
+
+  // in leaf order
+  std::vector<hitable*> list;
+  flat_bvh tree;
+};
+
+linear_bvh::linear_bvh(hitable** l, int n, float time0, float time1, int max_leaf) {
+  std::vector<bvh_primitive> prims = gather_primitives(l, n, time0, time1);
+  tree.build(prims, max_leaf);
+  list.resize(n);
+  for (int k = 0; k < n; k++)
+    list[k] = l[tree.order[k]];
+}
+
+bool linear_bvh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+  hit_record temp_rec;
+  return tree.traverse(r, t_min, t_max, [&](int k, float tmin, float& tmax) {
+    if (list[k]->hit(r, tmin, tmax, temp_rec)) {
+      tmax = temp_rec.t;
+      rec = temp_rec;
+      return true;
+    }
+    return false;
+  });
+}
+
+#endif
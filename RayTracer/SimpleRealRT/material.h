@@ -1,22 +1,38 @@
 #ifndef __MATERIAL__
 #define __MATERIAL__
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include "ray.h"
 #include "texture.h"
 #include "hitable.h"
+#include "onb.h"
+#include "sampler.h"
 
+// uniform on the sphere, z and the angle around it from one 2d point
+vec3 random_on_unit_sphere() {
+  float u, v;
+  random_pair(u, v);
+  float z = 1 - 2*u;
+  float r = sqrt(std::max(0.f, 1 - z*z));
+  float phi = 2*M_PI*v;
+  return vec3(r*cos(phi), r*sin(phi), z);
+}
+
+// uniform in the ball, a direction and a cube root radius
 vec3 random_in_unit_sphere() {
-  vec3 p;
-  do {
-    p = 2.0 * vec3(drand48(), drand48(), drand48()) - vec3(1,1,1);
-  } while (p.squared_length() >= 1.0);
-  return p;
+  vec3 d = random_on_unit_sphere();
+  return cbrt(random_float()) * d;
 }
 
-vec3 random_on_unit_sphere() {
-	vec3 res = random_in_unit_sphere();
-	res.make_unit_vector();
-	return res;
+// around the z axis, with density cos(theta) / pi.
+// a uniform disk point lifted onto the hemisphere (malley)
+vec3 random_cosine_direction() {
+  float u, v, x, y;
+  random_pair(u, v);
+  concentric_disk(u, v, x, y);
+  return vec3(x, y, sqrt(std::max(0.f, 1 - x*x - y*y)));
 }
 
 vec3 reflect(const vec3& v, const vec3& n) {
@@ -43,34 +59,97 @@ float schlick(float cosine, float ref_idx) {
   return f0 + (1-f0) * pow((1-cosine), 5);
 }
 
+// a direction drawn by material::sample()
+struct bsdf_sample {
+  ray scattered;
+  // the bsdf times the cosine at scattered (for volumes the phase
+  // function). for specular samples the attenuation itself.
+  vec3 f;
+  // solid angle density of the direction, 0 for specular samples
+  float pdf;
+  bool specular;
+};
+
+// the materials the material_*() functions dispatch with a switch,
+// any other material is open and goes through the virtual calls
+enum class material_kind : unsigned char {
+  open, lambertian, metal, dielectric, diffuse_light, isotropic
+};
+
+// materials are numbered as they are made, for the id buffer
+inline int next_material_id() {
+  static std::atomic<int> count(0);
+  return count++;
+}
+
 class material {
  public:
+  material(material_kind k = material_kind::open) : kind(k), id(next_material_id()) {}
   virtual bool scatter(const ray& r_in, const hit_record& rec,
                        vec3& attenuation, ray& scattered) const = 0;
   virtual vec3 emitted(float u, float v, const vec3& p) const {
     return vec3(0., 0., 0.);
   }
+
+  // draw a scattered direction, false when the path ends here.
+  // materials with only scatter() look specular to the integrator.
+  virtual bool sample(const ray& r_in, const hit_record& rec, bsdf_sample& s) const {
+    s.pdf = 0;
+    s.specular = true;
+    return scatter(r_in, rec, s.f, s.scattered);
+  }
+  // bsdf times cosine for a direction wi not drawn by sample(),
+  // e.g. towards a light sample. 0 for specular materials.
+  virtual vec3 eval(const ray& r_in, const hit_record& rec, const vec3& wi) const {
+    return vec3(0., 0., 0.);
+  }
+  // the density sample() would draw wi with
+  virtual float pdf(const ray& r_in, const hit_record& rec, const vec3& wi) const {
+    return 0.;
+  }
+
+  material_kind kind;
+  int id;
 };
 
 // Diffuse
-class lambertian : public material {
+class lambertian final : public material {
  public:
-  lambertian(texture* a) : albedo(a) {}
+  lambertian(texture* a) : material(material_kind::lambertian), albedo(a) {}
   virtual bool scatter(const ray& r_in, const hit_record& rec,
                        vec3& attenuation, ray& scattered) const {
     vec3 target = rec.p + rec.normal + random_on_unit_sphere();
     scattered = ray(rec.p, target - rec.p, r_in.time());
-    attenuation = albedo->value(rec.u, rec.v, rec.p);
+    attenuation = texture_value(albedo, rec.u, rec.v, rec.p, rec.footprint);
     return true;
   }
+  // cosine weighted, f / pdf is the albedo
+  virtual bool sample(const ray& r_in, const hit_record& rec, bsdf_sample& s) const {
+    vec3 direction = onb(rec.normal).local(random_cosine_direction());
+    s.scattered = ray(rec.p, direction, r_in.time());
+    s.f = eval(r_in, rec, direction);
+    s.pdf = pdf(r_in, rec, direction);
+    s.specular = false;
+    return s.pdf > 0;
+  }
+  virtual vec3 eval(const ray& r_in, const hit_record& rec, const vec3& wi) const {
+    float cosine = dot(rec.normal, unit_vector(wi));
+    if (cosine <= 0) return vec3(0., 0., 0.);
+    return texture_value(albedo, rec.u, rec.v, rec.p, rec.footprint) * (cosine / M_PI);
+  }
+  virtual float pdf(const ray& r_in, const hit_record& rec, const vec3& wi) const {
+    float cosine = dot(rec.normal, unit_vector(wi));
+    return cosine > 0 ? cosine / M_PI : 0;
+  }
 
   texture* albedo;
 };
 
 // Metal
-class metal : public material {
+// fuzzy reflection has no closed form density, sample() keeps it specular
+class metal final : public material {
  public:
-  metal(const vec3& a, float f) : albedo(a) {
+  metal(const vec3& a, float f) : material(material_kind::metal), albedo(a) {
     if (f < 1) fuzz = f; else fuzz = 1;
   }
   virtual bool scatter(const ray& r_in, const hit_record& rec,
@@ -87,9 +166,9 @@ class metal : public material {
 };
 
 // Dielectric
-class dielectric : public material {
+class dielectric final : public material {
  public:
-  dielectric(float ri) : ref_idx(ri) {}
+  dielectric(float ri) : material(material_kind::dielectric), ref_idx(ri) {}
   virtual bool scatter(const ray& r_in, const hit_record& rec,
                        vec3& attenuation, ray& scattered) const {
     vec3 outward_normal;
@@ -122,7 +201,7 @@ class dielectric : public material {
       reflect_prob = 1.0;
     }
 
-    if (drand48() < reflect_prob) {
+    if (random_float() < reflect_prob) {
       scattered = ray(rec.p, reflected, r_in.time());
     } else {
       scattered = ray(rec.p, refracted, r_in.time());
@@ -134,9 +213,9 @@ class dielectric : public material {
   float ref_idx;
 };
 
-class diffuse_light : public material {
+class diffuse_light final : public material {
  public:
-  diffuse_light(texture* a) : emit(a) {}
+  diffuse_light(texture* a) : material(material_kind::diffuse_light), emit(a) {}
   virtual bool scatter(const ray& r_in, const hit_record& rec,
                        vec3& attenuation, ray& scattered) const {
     // when the ray encountered emitting object, stop it.
@@ -146,24 +225,123 @@ class diffuse_light : public material {
   // emit ray
   virtual vec3 emitted(float u, float v, const vec3& p) const {
     // show the light color it is
-    return emit->value(u,v,p);
+    return texture_value(emit, u, v, p);
   }
 
   texture* emit;
 };
 
-class isotropic : public material {
+class isotropic final : public material {
  public:
-  isotropic(texture* a) : albedo(a) {}
+  isotropic(texture* a) : material(material_kind::isotropic), albedo(a) {}
   virtual bool scatter(const ray& r_in, const hit_record& rec,
                        vec3& attenuation, ray& scattered) const {
     // isotropic scatter
     scattered = ray(rec.p, random_on_unit_sphere());
-    attenuation = albedo->value(rec.u, rec.v, rec.p);
+    attenuation = texture_value(albedo, rec.u, rec.v, rec.p, rec.footprint);
+    return true;
+  }
+  // uniform over the sphere
+  virtual bool sample(const ray& r_in, const hit_record& rec, bsdf_sample& s) const {
+    s.scattered = ray(rec.p, random_on_unit_sphere(), r_in.time());
+    s.f = eval(r_in, rec, s.scattered.direction());
+    s.pdf = pdf(r_in, rec, s.scattered.direction());
+    s.specular = false;
     return true;
   }
+  virtual vec3 eval(const ray& r_in, const hit_record& rec, const vec3& wi) const {
+    return texture_value(albedo, rec.u, rec.v, rec.p, rec.footprint) / (4*M_PI);
+  }
+  virtual float pdf(const ray& r_in, const hit_record& rec, const vec3& wi) const {
+    return 1 / (4*M_PI);
+  }
 
   texture* albedo;
 };
 
+// the integrator's entry points. the casts to final classes make the
+// calls direct, one switch instead of a chain of virtual calls.
+template <class M>
+inline bool specular_sample(const M* m, const ray& r_in, const hit_record& rec, bsdf_sample& s) {
+  s.pdf = 0;
+  s.specular = true;
+  return m->scatter(r_in, rec, s.f, s.scattered);
+}
+
+inline bool material_sample(const material* m, const ray& r_in, const hit_record& rec,
+                            bsdf_sample& s) {
+  switch (m->kind) {
+    case material_kind::lambertian:
+      return static_cast<const lambertian*>(m)->sample(r_in, rec, s);
+    case material_kind::metal:
+      return specular_sample(static_cast<const metal*>(m), r_in, rec, s);
+    case material_kind::dielectric:
+      return specular_sample(static_cast<const dielectric*>(m), r_in, rec, s);
+    case material_kind::diffuse_light:
+      return false;
+    case material_kind::isotropic:
+      return static_cast<const isotropic*>(m)->sample(r_in, rec, s);
+    default:
+      return m->sample(r_in, rec, s);
+  }
+}
+
+inline vec3 material_eval(const material* m, const ray& r_in, const hit_record& rec,
+                          const vec3& wi) {
+  switch (m->kind) {
+    case material_kind::lambertian:
+      return static_cast<const lambertian*>(m)->eval(r_in, rec, wi);
+    case material_kind::isotropic:
+      return static_cast<const isotropic*>(m)->eval(r_in, rec, wi);
+    case material_kind::metal:
+    case material_kind::dielectric:
+    case material_kind::diffuse_light:
+      return vec3(0., 0., 0.);
+    default:
+      return m->eval(r_in, rec, wi);
+  }
+}
+
+inline float material_pdf(const material* m, const ray& r_in, const hit_record& rec,
+                          const vec3& wi) {
+  switch (m->kind) {
+    case material_kind::lambertian:
+      return static_cast<const lambertian*>(m)->pdf(r_in, rec, wi);
+    case material_kind::isotropic:
+      return static_cast<const isotropic*>(m)->pdf(r_in, rec, wi);
+    case material_kind::metal:
+    case material_kind::dielectric:
+    case material_kind::diffuse_light:
+      return 0;
+    default:
+      return m->pdf(r_in, rec, wi);
+  }
+}
+
+inline vec3 material_emitted(const material* m, float u, float v, const vec3& p) {
+  switch (m->kind) {
+    case material_kind::diffuse_light:
+      return static_cast<const diffuse_light*>(m)->emitted(u, v, p);
+    case material_kind::open:
+      return m->emitted(u, v, p);
+    default:
+      return vec3(0., 0., 0.);
+  }
+}
+
+// the reflectance of a first hit for the denoiser's albedo buffer.
+// 1 where it has none (glass, lights, materials of other kinds).
+inline vec3 material_albedo(const material* m, const hit_record& rec) {
+  switch (m->kind) {
+    case material_kind::lambertian:
+      return texture_value(static_cast<const lambertian*>(m)->albedo, rec.u, rec.v, rec.p, rec.footprint);
+    case material_kind::metal:
+      return static_cast<const metal*>(m)->albedo;
+    case material_kind::isotropic:
+      return texture_value(static_cast<const isotropic*>(m)->albedo, rec.u, rec.v, rec.p, rec.footprint);
+    default:
+      return vec3(1., 1., 1.);
+  }
+}
+
 #endif
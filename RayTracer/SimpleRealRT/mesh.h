@@ -0,0 +1,345 @@
+#ifndef __MESHH__
+#define __MESHH__
+/*
+class triangle_mesh.
+an indexed triangle mesh as one hitable. positions, normals and
+texture coordinates are shared buffers, every triangle corner indexes
+them separately (as OBJ does). a flat bvh over the triangles, built
+once, lives in the mesh, so a mesh can be placed many times with
+instance.
+
+the ray triangle test is watertight (woop, benthin and wald 2013):
+rays through an edge or a vertex shared by two triangles hit one of
+them, never none.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "hitable.h"
+#include "linear_bvh.h"
+
+struct mesh_data {
+  std::vector<vec3> positions;
+  // may be empty, the geometric normal is used then
+  std::vector<vec3> normals;
+  // u, v pairs, may be empty, the barycentrics are used then
+  std::vector<float> uvs;
+  // 3 per triangle. normal and uv indices are -1 where a corner has none.
+  std::vector<int> position_index;
+  std::vector<int> normal_index;
+  std::vector<int> uv_index;
+
+  int triangles() const { return static_cast<int>(position_index.size() / 3); }
+  // area weighted vertex normals, for meshes that come without
+  void compute_normals();
+};
+
+void mesh_data::compute_normals() {
+  normals.assign(positions.size(), vec3(0, 0, 0));
+  normal_index = position_index;
+  for (int t = 0; t < triangles(); t++) {
+    const int* i = &position_index[3*t];
+    // the cross product is twice the area, the weight comes free
+    vec3 n = cross(positions[i[1]] - positions[i[0]], positions[i[2]] - positions[i[0]]);
+    for (int k = 0; k < 3; k++) normals[i[k]] += n;
+  }
+  for (size_t k = 0; k < normals.size(); k++) {
+    if (normals[k].squared_length() > 0) normals[k].make_unit_vector();
+  }
+}
+
+// a face corner "v", "v/vt", "v//vn" or "v/vt/vn", 1-based or
+// negative (relative to the end). false for a malformed one.
+bool parse_obj_corner(const char* s, int nv, int nt, int nn, int& v, int& t, int& n) {
+  auto index = [](const char*& p, int count, int& out) {
+    char* end;
+    long i = strtol(p, &end, 10);
+    if (end == p) return false;
+    p = end;
+    out = i > 0 ? static_cast<int>(i - 1) : static_cast<int>(count + i);
+    return out >= 0 && out < count;
+  };
+  t = n = -1;
+  if (!index(s, nv, v)) return false;
+  if (*s != '/') return *s == 0;
+  s++;
+  if (*s != '/' && !index(s, nt, t)) return false;
+  if (*s != '/') return *s == 0;
+  s++;
+  return index(s, nn, n) && *s == 0;
+}
+
+// v, vt, vn and f lines, polygons are split into fans. everything
+// else (groups, materials, lines) is skipped.
+bool load_obj(const char* path, mesh_data& mesh) {
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    std::cerr << "cannot open " << path << "\n";
+    return false;
+  }
+  mesh = mesh_data();
+  bool any_normal = false, any_uv = false;
+  char line[4096];
+  int line_number = 0;
+  std::string text;
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), f)) {
+    line_number++;
+    text = line;
+    char* p = line;
+    while (*p == ' ' || *p == '\t') p++;
+    if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+      float x, y, z;
+      // sscanf takes inf, nan and overflows, the bvh cannot
+      ok = sscanf(p + 2, "%f %f %f", &x, &y, &z) == 3 &&
+           std::isfinite(x) && std::isfinite(y) && std::isfinite(z);
+      mesh.positions.push_back(vec3(x, y, z));
+    } else if (p[0] == 'v' && p[1] == 'n') {
+      float x, y, z;
+      ok = sscanf(p + 2, "%f %f %f", &x, &y, &z) == 3 &&
+           std::isfinite(x) && std::isfinite(y) && std::isfinite(z);
+      mesh.normals.push_back(unit_vector(vec3(x, y, z)));
+    } else if (p[0] == 'v' && p[1] == 't') {
+      float u = 0, v = 0;
+      ok = sscanf(p + 2, "%f %f", &u, &v) >= 1 && std::isfinite(u) && std::isfinite(v);
+      mesh.uvs.push_back(u);
+      mesh.uvs.push_back(v);
+    } else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+      int nv = static_cast<int>(mesh.positions.size());
+      int nt = static_cast<int>(mesh.uvs.size() / 2);
+      int nn = static_cast<int>(mesh.normals.size());
+      std::vector<int> v, t, n;
+      for (char* tok = strtok(p + 2, " \t\r\n"); tok && ok; tok = strtok(nullptr, " \t\r\n")) {
+        int a, b, c;
+        ok = parse_obj_corner(tok, nv, nt, nn, a, b, c);
+        v.push_back(a);
+        t.push_back(b);
+        n.push_back(c);
+      }
+      ok = ok && v.size() >= 3;
+      for (size_t k = 1; ok && k + 1 < v.size(); k++) {
+        size_t corner[3] = { 0, k, k + 1 };
+        for (size_t c : corner) {
+          mesh.position_index.push_back(v[c]);
+          mesh.uv_index.push_back(t[c]);
+          mesh.normal_index.push_back(n[c]);
+          any_uv = any_uv || t[c] >= 0;
+          any_normal = any_normal || n[c] >= 0;
+        }
+      }
+    }
+  }
+  fclose(f);
+  if (!ok) {
+    std::cerr << path << ":" << line_number << ": cannot parse " << text;
+    return false;
+  }
+  if (!any_uv) mesh.uv_index.clear();
+  if (!any_normal) mesh.normal_index.clear();
+  return true;
+}
+
+// the per ray part of the watertight test: the axis the direction is
+// largest along becomes z, a shear maps the direction onto it
+struct watertight_ray {
+  watertight_ray() {}
+  watertight_ray(const ray& r) : o(r.origin()) {
+    vec3 d = r.direction();
+    vec3 a(fabs(d.x()), fabs(d.y()), fabs(d.z()));
+    kz = a.x() > a.y() ? (a.x() > a.z() ? 0 : 2) : (a.y() > a.z() ? 1 : 2);
+    kx = (kz + 1) % 3;
+    ky = (kx + 1) % 3;
+    // keep the winding of the permuted triangle
+    if (d[kz] < 0) std::swap(kx, ky);
+    sz = 1 / d[kz];
+    sx = d[kx] * sz;
+    sy = d[ky] * sz;
+  }
+  vec3 o;
+  int kx, ky, kz;
+  float sx, sy, sz;
+};
+
+// true for a hit with t in (t_min, t_max), and its barycentrics
+inline bool watertight_hit(const watertight_ray& w, const vec3& p0, const vec3& p1,
+                           const vec3& p2, float t_min, float t_max,
+                           float& t, float& b1, float& b2) {
+  vec3 a = p0 - w.o, b = p1 - w.o, c = p2 - w.o;
+  float ax = a[w.kx] - w.sx*a[w.kz], ay = a[w.ky] - w.sy*a[w.kz];
+  float bx = b[w.kx] - w.sx*b[w.kz], by = b[w.ky] - w.sy*b[w.kz];
+  float cx = c[w.kx] - w.sx*c[w.kz], cy = c[w.ky] - w.sy*c[w.kz];
+  float u = cx*by - cy*bx;
+  float v = ax*cy - ay*cx;
+  float e = bx*ay - by*ax;
+  // exactly on an edge, the sign is decided in double
+  if (u == 0 || v == 0 || e == 0) {
+    u = static_cast<float>(static_cast<double>(cx)*by - static_cast<double>(cy)*bx);
+    v = static_cast<float>(static_cast<double>(ax)*cy - static_cast<double>(ay)*cx);
+    e = static_cast<float>(static_cast<double>(bx)*ay - static_cast<double>(by)*ax);
+  }
+  if ((u < 0 || v < 0 || e < 0) && (u > 0 || v > 0 || e > 0)) return false;
+  float det = u + v + e;
+  if (det == 0) return false;
+  // the scaled distance, divided only once it is known to be in range
+  float az = w.sz*a[w.kz], bz = w.sz*b[w.kz], cz = w.sz*c[w.kz];
+  float t_scaled = u*az + v*bz + e*cz;
+  if (det > 0 ? (t_scaled <= t_min*det || t_scaled >= t_max*det)
+              : (t_scaled >= t_min*det || t_scaled <= t_max*det)) return false;
+  float inv_det = 1 / det;
+  t = t_scaled * inv_det;
+  b1 = v * inv_det;
+  b2 = e * inv_det;
+  return true;
+}
+
+class triangle_mesh : public hitable {
+ public:
+  triangle_mesh(const mesh_data& data, material* m, int max_leaf = 4);
+  // a mesh already in leaf order and its tree, e.g. from a compiled scene
+  triangle_mesh(const mesh_data& leaf_order, const flat_bvh& t, material* m)
+    : mesh(leaf_order), mat_ptr(m), tree(t) {}
+  virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+  virtual bool bounding_box(float t0, float t1, aabb& box) const {
+    if (tree.nodes.empty()) return false;
+    box = tree.bounds();
+    return true;
+  }
+  virtual int hit_packet(const ray_packet& p, int active, float t_min,
+                         float* t_max, hit_record* rec) const;
+
+  // the triangles are reordered into leaf order at build time
+  mesh_data mesh;
+  material* mat_ptr;
+  flat_bvh tree;
+
+ private:
+  bool hit_triangle(int k, const watertight_ray& w, float t_min, float& t_max,
+                    float& b1, float& b2) const {
+    const int* i = &mesh.position_index[3*k];
+    float t;
+    if (!watertight_hit(w, mesh.positions[i[0]], mesh.positions[i[1]], mesh.positions[i[2]],
+                        t_min, t_max, t, b1, b2)) return false;
+    t_max = t;
+    return true;
+  }
+  void fill(int k, const ray& r, float t, float b1, float b2, hit_record& rec) const;
+};
+
+triangle_mesh::triangle_mesh(const mesh_data& data, material* m, int max_leaf)
+  : mat_ptr(m) {
+  int n = data.triangles();
+  std::vector<bvh_primitive> prims(n);
+  for (int k = 0; k < n; k++) {
+    const int* i = &data.position_index[3*k];
+    const vec3& p0 = data.positions[i[0]];
+    const vec3& p1 = data.positions[i[1]];
+    const vec3& p2 = data.positions[i[2]];
+    vec3 lo, hi;
+    for (int a = 0; a < 3; a++) {
+      lo[a] = ffmin(p0[a], ffmin(p1[a], p2[a]));
+      hi[a] = ffmax(p0[a], ffmax(p1[a], p2[a]));
+    }
+    prims[k].box = aabb(lo, hi);
+    prims[k].centroid = (p0 + p1 + p2) / 3;
+    prims[k].index = k;
+  }
+  tree.build(prims, max_leaf);
+
+  // the corners in leaf order, the vertex buffers stay shared
+  mesh.positions = data.positions;
+  mesh.normals = data.normals;
+  mesh.uvs = data.uvs;
+  for (int k : tree.order) {
+    for (int c = 0; c < 3; c++) {
+      mesh.position_index.push_back(data.position_index[3*k + c]);
+      if (!data.normal_index.empty()) mesh.normal_index.push_back(data.normal_index[3*k + c]);
+      if (!data.uv_index.empty()) mesh.uv_index.push_back(data.uv_index[3*k + c]);
+    }
+  }
+}
+
+void triangle_mesh::fill(int k, const ray& r, float t, float b1, float b2, hit_record& rec) const {
+  const int* i = &mesh.position_index[3*k];
+  float b0 = 1 - b1 - b2;
+  rec.t = t;
+  rec.p = r.point_at_parameter(t);
+  rec.mat_ptr = mat_ptr;
+  // outward by the winding, as for the other closed shapes
+  vec3 c = cross(mesh.positions[i[1]] - mesh.positions[i[0]],
+                 mesh.positions[i[2]] - mesh.positions[i[0]]);
+  // twice the areas, in space and in uv (barycentrics span 1)
+  float area = c.length(), uv_area = 1;
+  vec3 geometric = c / area;
+  rec.normal = geometric;
+  if (!mesh.normal_index.empty()) {
+    const int* ni = &mesh.normal_index[3*k];
+    if (ni[0] >= 0 && ni[1] >= 0 && ni[2] >= 0) {
+      vec3 n = b0*mesh.normals[ni[0]] + b1*mesh.normals[ni[1]] + b2*mesh.normals[ni[2]];
+      // a shading normal on the other side would turn the surface inside out
+      if (n.squared_length() > 0 && dot(n, geometric) > 0) rec.normal = unit_vector(n);
+    }
+  }
+  rec.u = b1;
+  rec.v = b2;
+  if (!mesh.uv_index.empty()) {
+    const int* ti = &mesh.uv_index[3*k];
+    if (ti[0] >= 0 && ti[1] >= 0 && ti[2] >= 0) {
+      rec.u = b0*mesh.uvs[2*ti[0]] + b1*mesh.uvs[2*ti[1]] + b2*mesh.uvs[2*ti[2]];
+      rec.v = b0*mesh.uvs[2*ti[0]+1] + b1*mesh.uvs[2*ti[1]+1] + b2*mesh.uvs[2*ti[2]+1];
+      float du1 = mesh.uvs[2*ti[1]] - mesh.uvs[2*ti[0]], dv1 = mesh.uvs[2*ti[1]+1] - mesh.uvs[2*ti[0]+1];
+      float du2 = mesh.uvs[2*ti[2]] - mesh.uvs[2*ti[0]], dv2 = mesh.uvs[2*ti[2]+1] - mesh.uvs[2*ti[0]+1];
+      uv_area = fabs(du1*dv2 - du2*dv1);
+    }
+  }
+  rec.uv_scale = area > 0 ? sqrt(uv_area / area) : 0;
+}
+
+bool triangle_mesh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+  watertight_ray w(r);
+  int best = -1;
+  float best_b1 = 0, best_b2 = 0;
+  tree.traverse(r, t_min, t_max, [&](int k, float tmin, float& tmax) {
+    float b1, b2;
+    if (!hit_triangle(k, w, tmin, tmax, b1, b2)) return false;
+    best = k;
+    best_b1 = b1;
+    best_b2 = b2;
+    t_max = tmax;
+    return true;
+  });
+  // the record is filled once, for the closest triangle only
+  if (best < 0) return false;
+  fill(best, r, t_max, best_b1, best_b2, rec);
+  return true;
+}
+
+int triangle_mesh::hit_packet(const ray_packet& p, int active, float t_min,
+                              float* t_max, hit_record* rec) const {
+  watertight_ray w[packet_size];
+  int best[packet_size];
+  float b1s[packet_size], b2s[packet_size];
+  for (int k = 0; k < packet_size; k++) {
+    if (active & (1 << k)) w[k] = watertight_ray(p.r[k]);
+    best[k] = -1;
+  }
+  int mask = tree.traverse_packet(p, active, t_min, t_max, [&](int tri, int m) {
+    int hit_mask = 0;
+    for (; m; m &= m - 1) {
+      int lane = __builtin_ctz(m);
+      if (!hit_triangle(tri, w[lane], t_min, t_max[lane], b1s[lane], b2s[lane])) continue;
+      best[lane] = tri;
+      hit_mask |= 1 << lane;
+    }
+    return hit_mask;
+  });
+  for (int k = 0; k < packet_size; k++)
+    if (mask & (1 << k)) fill(best[k], p.r[k], t_max[k], b1s[k], b2s[k], rec[k]);
+  return mask;
+}
+
+#endif
@@ -1,18 +1,77 @@
 #ifndef __PERLINH__
 #define __PERLINH__
 
+#include <algorithm>
 #include <cmath>
 #include "vec3.h"
 #include "interp.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 /*
   class valuen.
   3D value noise.
 
   class perlin.
   3D perlin noise.
+
+  both also take points in batches, x, y and z as separate arrays.
+  with -mavx2 every 8 points are one AVX sequence: the lattice corners
+  are gathered from the permutation tables and the trilinear
+  interpolation is written out as 7 lerps. fbm() puts the octaves of a
+  single point into the lanes, so turb() is one pass for up to 8
+  octaves. without AVX2 the batches loop over noise().
 */
 
+// points evaluated together by the batch functions
+const int noise_batch = 8;
+
+#if defined(__AVX2__)
+// the lattice cell of 8 points: the permuted coordinates of the two
+// corners along each axis, and the smoothed offsets in the cell
+struct noise_cell8 {
+  noise_cell8(__m256 x, __m256 y, __m256 z, const int* px, const int* py, const int* pz);
+  __m256i hx[2], hy[2], hz[2];
+  __m256 u, v, w;
+};
+
+noise_cell8::noise_cell8(__m256 x, __m256 y, __m256 z,
+                         const int* px, const int* py, const int* pz) {
+  __m256 fx = _mm256_floor_ps(x), fy = _mm256_floor_ps(y), fz = _mm256_floor_ps(z);
+  __m256i ix = _mm256_cvttps_epi32(fx), iy = _mm256_cvttps_epi32(fy), iz = _mm256_cvttps_epi32(fz);
+  __m256i mask = _mm256_set1_epi32(255), one = _mm256_set1_epi32(1);
+  hx[0] = _mm256_i32gather_epi32(px, _mm256_and_si256(ix, mask), 4);
+  hx[1] = _mm256_i32gather_epi32(px, _mm256_and_si256(_mm256_add_epi32(ix, one), mask), 4);
+  hy[0] = _mm256_i32gather_epi32(py, _mm256_and_si256(iy, mask), 4);
+  hy[1] = _mm256_i32gather_epi32(py, _mm256_and_si256(_mm256_add_epi32(iy, one), mask), 4);
+  hz[0] = _mm256_i32gather_epi32(pz, _mm256_and_si256(iz, mask), 4);
+  hz[1] = _mm256_i32gather_epi32(pz, _mm256_and_si256(_mm256_add_epi32(iz, one), mask), 4);
+  // heimite cubic, as in noise()
+  __m256 three = _mm256_set1_ps(3), two = _mm256_set1_ps(2);
+  u = _mm256_sub_ps(x, fx);
+  v = _mm256_sub_ps(y, fy);
+  w = _mm256_sub_ps(z, fz);
+  u = _mm256_mul_ps(_mm256_mul_ps(u, u), _mm256_sub_ps(three, _mm256_mul_ps(two, u)));
+  v = _mm256_mul_ps(_mm256_mul_ps(v, v), _mm256_sub_ps(three, _mm256_mul_ps(two, v)));
+  w = _mm256_mul_ps(_mm256_mul_ps(w, w), _mm256_sub_ps(three, _mm256_mul_ps(two, w)));
+}
+
+inline __m256 lerp8(__m256 a, __m256 b, __m256 t) {
+  return _mm256_add_ps(a, _mm256_mul_ps(t, _mm256_sub_ps(b, a)));
+}
+
+// c[di][dj][dk] weighted by the cell offsets
+inline __m256 trilinear8(const __m256 c[2][2][2], const noise_cell8& cell) {
+  __m256 c00 = lerp8(c[0][0][0], c[0][0][1], cell.w);
+  __m256 c01 = lerp8(c[0][1][0], c[0][1][1], cell.w);
+  __m256 c10 = lerp8(c[1][0][0], c[1][0][1], cell.w);
+  __m256 c11 = lerp8(c[1][1][0], c[1][1][1], cell.w);
+  return lerp8(lerp8(c00, c01, cell.v), lerp8(c10, c11, cell.v), cell.u);
+}
+#endif
+
 // value noise
 class valuen {
  public:
@@ -44,6 +103,11 @@ class valuen {
     }
     return trilinear_interp(c, u, v, w);
   }
+  // the n points (x[i], y[i], z[i]) into out[i]
+  void noise(const float* x, const float* y, const float* z, float* out, int n) const;
+#if defined(__AVX2__)
+  __m256 noise8(__m256 x, __m256 y, __m256 z) const;
+#endif
 
   // use permutation table to save ram
   static float* ranfloat;
@@ -85,6 +149,40 @@ int* valuen::perm_x = generate_perm();
 int* valuen::perm_y = generate_perm();
 int* valuen::perm_z = generate_perm();
 
+#if defined(__AVX2__)
+__m256 valuen::noise8(__m256 x, __m256 y, __m256 z) const {
+  noise_cell8 cell(x, y, z, perm_x, perm_y, perm_z);
+  __m256 c[2][2][2];
+  for (int di = 0; di < 2; di++)
+    for (int dj = 0; dj < 2; dj++)
+      for (int dk = 0; dk < 2; dk++) {
+        __m256i h = _mm256_xor_si256(_mm256_xor_si256(cell.hx[di], cell.hy[dj]), cell.hz[dk]);
+        c[di][dj][dk] = _mm256_i32gather_ps(ranfloat, h, 4);
+      }
+  return trilinear8(c, cell);
+}
+#endif
+
+void valuen::noise(const float* x, const float* y, const float* z, float* out, int n) const {
+#if defined(__AVX2__)
+  int s = 0;
+  for (; s + noise_batch <= n; s += noise_batch)
+    _mm256_storeu_ps(out + s, noise8(_mm256_loadu_ps(x + s), _mm256_loadu_ps(y + s),
+                                     _mm256_loadu_ps(z + s)));
+  // the last points, the empty lanes at 0
+  if (s < n) {
+    float tx[noise_batch] = {}, ty[noise_batch] = {}, tz[noise_batch] = {}, r[noise_batch];
+    std::copy(x + s, x + n, tx);
+    std::copy(y + s, y + n, ty);
+    std::copy(z + s, z + n, tz);
+    _mm256_storeu_ps(r, noise8(_mm256_loadu_ps(tx), _mm256_loadu_ps(ty), _mm256_loadu_ps(tz)));
+    std::copy(r, r + (n - s), out + s);
+  }
+#else
+  for (int i = 0; i < n; i++) out[i] = noise(vec3(x[i], y[i], z[i]));
+#endif
+}
+
 // perline noise
 class perlin {
  public:
@@ -118,16 +216,19 @@ class perlin {
   }
 
   float turb(const vec3& p, int depth=7) const {
-    float accum = 0;
-    vec3 temp_p = p;
-    float weight = 1.0;
-    for (int i = 0; i < depth; i++) {
-      accum += weight*noise(temp_p);
-      weight *= 0.5;
-      temp_p *= 2;
-    }
-    return fabs(accum);
+    return fabs(fbm(p, depth));
   }
+  // octaves of noise at p, each at twice the frequency and gain times
+  // the weight of the last
+  float fbm(const vec3& p, int octaves, float gain = 0.5) const;
+
+  // the n points (x[i], y[i], z[i]) into out[i]
+  void noise(const float* x, const float* y, const float* z, float* out, int n) const;
+  void turb(const float* x, const float* y, const float* z, float* out, int n,
+            int depth=7) const;
+#if defined(__AVX2__)
+  __m256 noise8(__m256 x, __m256 y, __m256 z) const;
+#endif
 
   // use permutation table to save ram
   static vec3* ranvec;
@@ -149,4 +250,113 @@ int* perlin::perm_x = generate_perm();
 int* perlin::perm_y = generate_perm();
 int* perlin::perm_z = generate_perm();
 
+#if defined(__AVX2__)
+__m256 perlin::noise8(__m256 x, __m256 y, __m256 z) const {
+  noise_cell8 cell(x, y, z, perm_x, perm_y, perm_z);
+  const float* rv = ranvec[0].e;
+  __m256 one = _mm256_set1_ps(1);
+  __m256 du[2] = { cell.u, _mm256_sub_ps(cell.u, one) };
+  __m256 dv[2] = { cell.v, _mm256_sub_ps(cell.v, one) };
+  __m256 dw[2] = { cell.w, _mm256_sub_ps(cell.w, one) };
+  __m256i stride = _mm256_set1_epi32(3);
+  __m256 c[2][2][2];
+  for (int di = 0; di < 2; di++)
+    for (int dj = 0; dj < 2; dj++)
+      for (int dk = 0; dk < 2; dk++) {
+        // the gradient of the corner, dotted with the offset to it
+        __m256i h = _mm256_xor_si256(_mm256_xor_si256(cell.hx[di], cell.hy[dj]), cell.hz[dk]);
+        h = _mm256_mullo_epi32(h, stride);
+        __m256 gx = _mm256_i32gather_ps(rv, h, 4);
+        __m256 gy = _mm256_i32gather_ps(rv + 1, h, 4);
+        __m256 gz = _mm256_i32gather_ps(rv + 2, h, 4);
+        c[di][dj][dk] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(gx, du[di]), _mm256_mul_ps(gy, dv[dj])),
+                                      _mm256_mul_ps(gz, dw[dk]));
+      }
+  return trilinear8(c, cell);
+}
+#endif
+
+// the octaves of one point side by side in the lanes, 8 per pass
+float perlin::fbm(const vec3& p, int octaves, float gain) const {
+#if defined(__AVX2__)
+  float sum = 0;
+  float scale = 1, weight = 1;
+  for (int o = 0; o < octaves; o += noise_batch) {
+    float x[noise_batch], y[noise_batch], z[noise_batch], w[noise_batch], r[noise_batch];
+    for (int k = 0; k < noise_batch; k++) {
+      x[k] = scale * p.x();
+      y[k] = scale * p.y();
+      z[k] = scale * p.z();
+      w[k] = o + k < octaves ? weight : 0;
+      scale *= 2;
+      weight *= gain;
+    }
+    __m256 n = noise8(_mm256_loadu_ps(x), _mm256_loadu_ps(y), _mm256_loadu_ps(z));
+    _mm256_storeu_ps(r, _mm256_mul_ps(n, _mm256_loadu_ps(w)));
+    for (int k = 0; k < noise_batch; k++) sum += r[k];
+  }
+  return sum;
+#else
+  float accum = 0;
+  vec3 temp_p = p;
+  float weight = 1.0;
+  for (int i = 0; i < octaves; i++) {
+    accum += weight*noise(temp_p);
+    weight *= gain;
+    temp_p *= 2;
+  }
+  return accum;
+#endif
+}
+
+void perlin::noise(const float* x, const float* y, const float* z, float* out, int n) const {
+#if defined(__AVX2__)
+  int s = 0;
+  for (; s + noise_batch <= n; s += noise_batch)
+    _mm256_storeu_ps(out + s, noise8(_mm256_loadu_ps(x + s), _mm256_loadu_ps(y + s),
+                                     _mm256_loadu_ps(z + s)));
+  // the last points, the empty lanes at 0
+  if (s < n) {
+    float tx[noise_batch] = {}, ty[noise_batch] = {}, tz[noise_batch] = {}, r[noise_batch];
+    std::copy(x + s, x + n, tx);
+    std::copy(y + s, y + n, ty);
+    std::copy(z + s, z + n, tz);
+    _mm256_storeu_ps(r, noise8(_mm256_loadu_ps(tx), _mm256_loadu_ps(ty), _mm256_loadu_ps(tz)));
+    std::copy(r, r + (n - s), out + s);
+  }
+#else
+  for (int i = 0; i < n; i++) out[i] = noise(vec3(x[i], y[i], z[i]));
+#endif
+}
+
+// the octaves one after the other, 8 points in every pass
+void perlin::turb(const float* x, const float* y, const float* z, float* out, int n,
+                  int depth) const {
+#if defined(__AVX2__)
+  for (int s = 0; s < n; s += noise_batch) {
+    int m = std::min(noise_batch, n - s);
+    float tx[noise_batch] = {}, ty[noise_batch] = {}, tz[noise_batch] = {}, r[noise_batch];
+    std::copy(x + s, x + s + m, tx);
+    std::copy(y + s, y + s + m, ty);
+    std::copy(z + s, z + s + m, tz);
+    __m256 px = _mm256_loadu_ps(tx), py = _mm256_loadu_ps(ty), pz = _mm256_loadu_ps(tz);
+    __m256 accum = _mm256_setzero_ps(), two = _mm256_set1_ps(2);
+    float weight = 1;
+    for (int i = 0; i < depth; i++) {
+      accum = _mm256_add_ps(accum, _mm256_mul_ps(_mm256_set1_ps(weight), noise8(px, py, pz)));
+      weight *= 0.5;
+      px = _mm256_mul_ps(px, two);
+      py = _mm256_mul_ps(py, two);
+      pz = _mm256_mul_ps(pz, two);
+    }
+    // fabs, the sign bit cleared
+    accum = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), accum);
+    _mm256_storeu_ps(r, accum);
+    std::copy(r, r + m, out + s);
+  }
+#else
+  for (int i = 0; i < n; i++) out[i] = turb(vec3(x[i], y[i], z[i]), depth);
+#endif
+}
+
 #endif
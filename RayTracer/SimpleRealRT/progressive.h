@@ -0,0 +1,169 @@
+#ifndef __PROGRESSIVEH__
+#define __PROGRESSIVEH__
+/*
+progressive rendering.
+the image is rendered in passes of a few spp into the framebuffer,
+until a target spp is reached or a wall-clock budget runs out. the
+accumulated sums and counts are written to a checkpoint file now and
+then, a later run loads it and carries on where the last one stopped.
+a checkpoint carries a key of the camera and the scene, one of another
+scene is ignored. it is removed once the image is done, so a finished
+render is not handed out again.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include "camera.h"
+#include "render.h"
+#include "sampler.h"
+
+struct progressive_options {
+  progressive_options()
+    : target_spp(1000), pass_spp(8), time_budget(0),
+      checkpoint(nullptr), checkpoint_interval(60), key(0) {}
+
+  int target_spp;
+  int pass_spp;
+  // seconds, 0 for no limit
+  double time_budget;
+  // file name, nullptr for no checkpoints
+  const char* checkpoint;
+  // seconds between two checkpoints
+  double checkpoint_interval;
+  // what the image is of, see checkpoint_key()
+  uint64_t key;
+};
+
+static const char checkpoint_magic[8] = {'S', 'R', 'T', 'C', 'K', 'P', 'T', '2'};
+
+// folds the bytes of v into a checkpoint key
+template <class T>
+uint64_t hash_key(uint64_t key, const T& v) {
+  const unsigned char* b = reinterpret_cast<const unsigned char*>(&v);
+  for (size_t i = 0; i < sizeof(T); i++) key = mix_bits(key ^ b[i]);
+  return key;
+}
+
+// the camera and a tag for the scene: its name, or a hash of the scene
+// file. options that change the image (e.g. adaptive_options) can be
+// folded in with hash_key().
+uint64_t checkpoint_key(const camera& cam, const char* tag) {
+  uint64_t key = 0;
+  for (const char* c = tag; *c; c++) key = mix_bits(key ^ static_cast<unsigned char>(*c));
+  key = hash_key(key, cam.origin);
+  key = hash_key(key, cam.lower_left_corner);
+  key = hash_key(key, cam.horizontal);
+  key = hash_key(key, cam.vertical);
+  key = hash_key(key, cam.lens_radius);
+  key = hash_key(key, cam.time0);
+  return hash_key(key, cam.time1);
+}
+
+// written next to the target and renamed over it, a killed run
+// never leaves a half written checkpoint behind
+bool save_checkpoint(const framebuffer& fb, const char* path, uint64_t key = 0) {
+  std::string tmp = std::string(path) + ".tmp";
+  FILE* f = fopen(tmp.c_str(), "wb");
+  if (!f) {
+    std::cerr << "cannot write checkpoint " << tmp << "\n";
+    return false;
+  }
+  int size[2] = { fb.nx, fb.ny };
+  bool ok = fwrite(checkpoint_magic, 1, 8, f) == 8 &&
+            fwrite(size, sizeof(int), 2, f) == 2 &&
+            fwrite(&key, sizeof(key), 1, f) == 1 &&
+            fwrite(fb.sum.data(), sizeof(vec3), fb.sum.size(), f) == fb.sum.size() &&
+            fwrite(fb.count.data(), sizeof(int), fb.count.size(), f) == fb.count.size();
+  ok = (fclose(f) == 0) && ok;
+  if (!ok || rename(tmp.c_str(), path) != 0) {
+    std::cerr << "cannot write checkpoint " << path << "\n";
+    return false;
+  }
+  return true;
+}
+
+// false when there is no checkpoint, or one of another image size or key
+bool load_checkpoint(framebuffer& fb, const char* path, uint64_t key = 0) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  char magic[8];
+  int size[2];
+  uint64_t saved_key;
+  bool ok = fread(magic, 1, 8, f) == 8 &&
+            std::equal(magic, magic + 8, checkpoint_magic) &&
+            fread(size, sizeof(int), 2, f) == 2 &&
+            size[0] == fb.nx && size[1] == fb.ny &&
+            fread(&saved_key, sizeof(saved_key), 1, f) == 1 && saved_key == key;
+  if (ok) {
+    framebuffer loaded(fb.nx, fb.ny);
+    // the features start over, they are not in the checkpoint
+    if (fb.has_features()) loaded.keep_features();
+    ok = fread(loaded.sum.data(), sizeof(vec3), loaded.sum.size(), f) == loaded.sum.size() &&
+         fread(loaded.count.data(), sizeof(int), loaded.count.size(), f) == loaded.count.size();
+    if (ok) fb = loaded;
+  }
+  fclose(f);
+  if (!ok) std::cerr << "ignoring checkpoint " << path << ", it is of another image or scene\n";
+  return ok;
+}
+
+inline int max_spp(const framebuffer& fb) {
+  return fb.count.empty() ? 0 : *std::max_element(fb.count.begin(), fb.count.end());
+}
+
+inline long total_samples(const framebuffer& fb) {
+  long total = 0;
+  for (int c : fb.count) total += c;
+  return total;
+}
+
+// pass(fb, n) renders up to n more samples into fb, e.g. a call of
+// render(). returns the spp reached, the most any pixel has. stops
+// early once a pass adds nothing (an adaptive sampler has converged).
+template <class Pass>
+int render_progressive(framebuffer& fb, Pass pass, const progressive_options& opt) {
+  typedef std::chrono::steady_clock clock;
+  clock::time_point start = clock::now();
+  clock::time_point last_checkpoint = start;
+
+  if (opt.checkpoint && load_checkpoint(fb, opt.checkpoint, opt.key))
+    std::cerr << "resumed " << opt.checkpoint << " at " << max_spp(fb) << " spp\n";
+
+  int spp = max_spp(fb);
+  double pass_time = 0;
+  // false when the budget ran out first
+  bool done = true;
+  while (spp < opt.target_spp) {
+    double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    // stop before a pass that would overrun the budget
+    if (opt.time_budget > 0 && elapsed + pass_time > opt.time_budget) {
+      done = false;
+      break;
+    }
+
+    int n = std::min(opt.pass_spp, opt.target_spp - spp);
+    clock::time_point t0 = clock::now();
+    long before = total_samples(fb);
+    pass(fb, n);
+    pass_time = std::chrono::duration<double>(clock::now() - t0).count();
+    if (total_samples(fb) == before) break;
+    spp = max_spp(fb);
+    std::cerr << "\r" << spp << " / " << opt.target_spp << " spp" << std::flush;
+
+    if (opt.checkpoint &&
+        std::chrono::duration<double>(clock::now() - last_checkpoint).count() > opt.checkpoint_interval) {
+      save_checkpoint(fb, opt.checkpoint, opt.key);
+      last_checkpoint = clock::now();
+    }
+  }
+  std::cerr << "\n";
+  if (opt.checkpoint && done) remove(opt.checkpoint);
+  else if (opt.checkpoint) save_checkpoint(fb, opt.checkpoint, opt.key);
+  return spp;
+}
+
+#endif
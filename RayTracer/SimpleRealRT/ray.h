@@ -2,6 +2,7 @@
 #define __RAYH__
 /*
 Class: Ray
+the inverse direction and its signs are cached for the box tests.
  */
 
 #include "vec3.h"
@@ -10,17 +11,27 @@ class ray {
  public:
   ray() {}
   ray(const vec3 &a, const vec3 &b, float ti = 0.0)
-    : A(a), B(b), _time(ti) {}
+    : A(a), B(b), _time(ti) {
+    inv_B = vec3(1 / b.x(), 1 / b.y(), 1 / b.z());
+    sign[0] = inv_B.x() < 0;
+    sign[1] = inv_B.y() < 0;
+    sign[2] = inv_B.z() < 0;
+  }
 
   // access
   vec3 origin() const { return A; }
   vec3 direction() const { return B; }
+  vec3 inv_direction() const { return inv_B; }
   vec3 point_at_parameter(const float t) const { return A + t*B; }
   float time() const { return _time; }
 
   vec3 A;
   vec3 B;
+  // _time right after inv_B keeps a 4-wide load of it free of denormals
+  vec3 inv_B;
   float _time;
+  // 1 where the direction is negative
+  int sign[3];
 };
 
 #endif
@@ -0,0 +1,116 @@
+#ifndef __RAYPACKETH__
+#define __RAYPACKETH__
+/*
+struct ray_packet.
+8 rays traced together, in SoA layout so the per-lane loops vectorize.
+the interval bounds of the origins and inverse directions let a whole
+packet reject a box at once (interval arithmetic), which is what
+coherent camera rays gain from.
+ */
+
+#include <cfloat>
+#include "ray.h"
+#include "aabb.h"
+#include "sampler.h"
+
+const int packet_size = 8;
+
+struct ray_packet {
+  ray_packet() {}
+  // lanes [0, n) from rays, the remaining lanes stay inactive
+  ray_packet(const ray* rays, int n);
+
+  // the lanes as plain rays, for the scalar fallbacks
+  ray r[packet_size];
+  float o[3][packet_size];
+  float d[3][packet_size];
+  float inv[3][packet_size];
+
+  // bounds over the active lanes
+  float omin[3], omax[3];
+  float imin[3], imax[3];
+  // direction signs agree on all axes and no component is 0,
+  // the interval test is valid
+  bool coherent;
+  // the signs of the first lane
+  int sign[3];
+  int active;
+  // random streams of the lanes, for hitables that draw numbers
+  // (constant_medium). may be null.
+  sampler* streams;
+};
+
+ray_packet::ray_packet(const ray* rays, int n) {
+  active = (1 << n) - 1;
+  coherent = true;
+  streams = nullptr;
+  for (int k = 0; k < packet_size; k++) {
+    // inactive lanes repeat the first ray, their results are never read
+    r[k] = rays[k < n ? k : 0];
+    for (int a = 0; a < 3; a++) {
+      o[a][k] = r[k].A[a];
+      d[a][k] = r[k].B[a];
+      inv[a][k] = r[k].inv_B[a];
+    }
+  }
+  for (int a = 0; a < 3; a++) {
+    sign[a] = r[0].sign[a];
+    omin[a] = omax[a] = o[a][0];
+    imin[a] = imax[a] = inv[a][0];
+    for (int k = 1; k < n; k++) {
+      omin[a] = ffmin(omin[a], o[a][k]);
+      omax[a] = ffmax(omax[a], o[a][k]);
+      imin[a] = ffmin(imin[a], inv[a][k]);
+      imax[a] = ffmax(imax[a], inv[a][k]);
+      if (r[k].sign[a] != sign[a]) coherent = false;
+    }
+    if (!(imin[a] > -FLT_MAX && imax[a] < FLT_MAX)) coherent = false;
+  }
+}
+
+// lanes of active whose ray may enter the box b (6 floats, min then max)
+// before their t_max. conservative: lanes that miss can be kept, the
+// primitive tests are exact per lane.
+inline int packet_slab_hit(const float* b, const ray_packet& p, int active,
+                           float t_min, const float* t_max) {
+  if (!active) return 0;
+  // if the first active lane enters, take them all
+  int first = __builtin_ctz(active);
+  if (slab_hit(b, p.r[first], t_min, t_max[first])) return active;
+
+  if (p.coherent) {
+    // interval arithmetic: the earliest entry and the latest exit any
+    // lane can have, if even those miss, every lane misses
+    float tnear = t_min;
+    float tfar = -FLT_MAX;
+    for (int k = 0; k < packet_size; k++)
+      if (active & (1 << k)) tfar = ffmax(tfar, t_max[k]);
+    for (int a = 0; a < 3; a++) {
+      float lo = p.sign[a] ? b[3+a] : b[a];
+      float hi = p.sign[a] ? b[a] : b[3+a];
+      float n0 = (lo - p.omin[a]) * p.imin[a], n1 = (lo - p.omin[a]) * p.imax[a];
+      float n2 = (lo - p.omax[a]) * p.imin[a], n3 = (lo - p.omax[a]) * p.imax[a];
+      float f0 = (hi - p.omin[a]) * p.imin[a], f1 = (hi - p.omin[a]) * p.imax[a];
+      float f2 = (hi - p.omax[a]) * p.imin[a], f3 = (hi - p.omax[a]) * p.imax[a];
+      tnear = ffmax(tnear, ffmin(ffmin(n0, n1), ffmin(n2, n3)));
+      tfar = ffmin(tfar, ffmax(ffmax(f0, f1), ffmax(f2, f3)));
+    }
+    if (tnear > tfar) return 0;
+  }
+
+  int mask = 0;
+  for (int k = 0; k < packet_size; k++) {
+    float tnear = t_min;
+    float tfar = t_max[k];
+    for (int a = 0; a < 3; a++) {
+      float t0 = (b[a] - p.o[a][k]) * p.inv[a][k];
+      float t1 = (b[3+a] - p.o[a][k]) * p.inv[a][k];
+      tnear = ffmax(ffmin(t0, t1), tnear);
+      tfar = ffmin(ffmax(t0, t1), tfar);
+    }
+    mask |= (tnear < tfar) << k;
+  }
+  return mask & active;
+}
+
+#endif
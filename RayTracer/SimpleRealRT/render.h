@@ -0,0 +1,301 @@
+#ifndef __RENDERH__
+#define __RENDERH__
+/*
+the shared render driver.
+the image is cut into square tiles, the tiles are rendered on a
+work-stealing thread pool and accumulated into a float framebuffer.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include "camera.h"
+#include "hitable.h"
+#include "image_io.h"
+#include "integrator.h"
+#include "material.h"
+#include "ray_packet.h"
+#include "sampler.h"
+#include "thread_pool.h"
+
+// the per-scene color() function
+typedef vec3 (*integrator)(const ray& r, hitable* world, int iter);
+
+inline float luminance(const vec3& c) {
+  return 0.2126 * c[0] + 0.7152 * c[1] + 0.0722 * c[2];
+}
+
+// what a camera ray saw first, for the denoiser and the aov file
+struct feature_sample {
+  vec3 albedo;
+  // 0 for a miss and inside media
+  vec3 normal;
+  // distance along the camera ray, 0 for a miss
+  float depth;
+  // material::id, -1 for a miss
+  int id;
+  // surfaces the whole path hit
+  int vertices;
+};
+
+// linear radiance, row j = 0 is the bottom of the image
+class framebuffer {
+ public:
+  framebuffer(int w, int h)
+    : nx(w), ny(h), sum(w*h, vec3(0, 0, 0)), count(w*h, 0) {}
+
+  void add(int i, int j, const vec3& c) {
+    sum[j*nx + i] += c;
+    count[j*nx + i]++;
+  }
+
+  // mean of all samples of a pixel
+  vec3 color(int i, int j) const {
+    int n = count[j*nx + i];
+    return n > 0 ? sum[j*nx + i] / static_cast<float>(n) : vec3(0, 0, 0);
+  }
+
+  // from now on render_packets() and the adaptive sampler also sum
+  // the first hit features and the squared sample luminance
+  void keep_features();
+  bool has_features() const { return !albedo.empty(); }
+  void add_features(int p, const feature_sample& f, const vec3& c) {
+    albedo[p] += f.albedo;
+    normal[p] += f.normal;
+    depth[p] += f.depth;
+    float l = luminance(c);
+    moment[p] += l*l;
+    path_length[p] += f.vertices;
+    // ids do not average, the first sample's is kept
+    if (feature_count[p]++ == 0) id[p] = f.id;
+  }
+
+  int nx, ny;
+  std::vector<vec3> sum;
+  std::vector<int> count;
+
+  // sums, over feature_count samples (a resumed render has fewer
+  // of those than count)
+  std::vector<vec3> albedo;
+  std::vector<vec3> normal;
+  std::vector<float> depth;
+  std::vector<float> moment;
+  std::vector<float> path_length;
+  std::vector<int> id;
+  std::vector<int> feature_count;
+};
+
+void framebuffer::keep_features() {
+  if (has_features()) return;
+  albedo.assign(nx*ny, vec3(0, 0, 0));
+  normal.assign(nx*ny, vec3(0, 0, 0));
+  depth.assign(nx*ny, 0);
+  moment.assign(nx*ny, 0);
+  path_length.assign(nx*ny, 0);
+  id.assign(nx*ny, -1);
+  feature_count.assign(nx*ny, 0);
+}
+
+thread_pool& render_pool() {
+  static thread_pool pool;
+  return pool;
+}
+
+// trace ns more samples for every pixel. the sample index continues
+// from the pixel's count, so several calls add up to one longer render.
+void render(framebuffer& fb, const camera& cam, hitable* world, int ns,
+            integrator color, int tile_size = 16) {
+  int ntx = (fb.nx + tile_size - 1) / tile_size;
+  int nty = (fb.ny + tile_size - 1) / tile_size;
+
+  render_pool().parallel_for(ntx*nty, [&](int tile) {
+    int i0 = (tile % ntx) * tile_size;
+    int j0 = (tile / ntx) * tile_size;
+    int i1 = std::min(i0 + tile_size, fb.nx);
+    int j1 = std::min(j0 + tile_size, fb.ny);
+    for (int j = j0; j < j1; j++) {
+      for (int i = i0; i < i1; i++) {
+        // the tile is owned by this worker, no locking on the pixels
+        vec3 colorx(0, 0, 0);
+        for (int s = 0; s < ns; s++) {
+          // every sample gets its own stream, whatever thread runs it
+          thread_sampler().start(i, j, fb.nx, fb.count[j*fb.nx + i] + s);
+          float du, dv;
+          random_pair(du, dv);
+          float u = static_cast<float>(i + du) / static_cast<float>(fb.nx);
+          float v = static_cast<float>(j + dv) / static_cast<float>(fb.ny);
+          ray r = cam.get_ray(u, v);
+          colorx += color(r, world, 0);
+        }
+        fb.sum[j*fb.nx + i] += colorx;
+        fb.count[j*fb.nx + i] += ns;
+      }
+    }
+  });
+}
+
+// one sample of the n <= packet_size pixels xs[0..n) of row j, their
+// camera rays traced as one packet, then every path goes on alone.
+// s is the sample index past each pixel's count. features, when
+// given, get the first hit of every lane.
+void trace_packet(const framebuffer& fb, const camera& cam, hitable* world, background env,
+                  const hitable* lights, int j, const int* xs, int n, int s, vec3* color,
+                  feature_sample* features = nullptr) {
+  ray rays[packet_size];
+  // where each lane's random stream stands after its camera ray
+  sampler streams[packet_size];
+  for (int k = 0; k < n; k++) {
+    thread_sampler().start(xs[k], j, fb.nx, fb.count[j*fb.nx + xs[k]] + s);
+    float du, dv;
+    random_pair(du, dv);
+    float u = static_cast<float>(xs[k] + du) / static_cast<float>(fb.nx);
+    float v = static_cast<float>(j + dv) / static_cast<float>(fb.ny);
+    rays[k] = cam.get_ray(u, v);
+    streams[k] = thread_sampler();
+  }
+
+  ray_packet packet(rays, n);
+  packet.streams = streams;
+  float t_max[packet_size];
+  hit_record rec[packet_size];
+  for (int k = 0; k < packet_size; k++) t_max[k] = MAXFLOAT;
+  int mask = world->hit_packet(packet, packet.active, 0.001, t_max, rec);
+
+  float spread = cam.pixel_spread(fb.ny);
+  for (int k = 0; k < n; k++) {
+    thread_sampler() = streams[k];
+    int* vertices = features ? &features[k].vertices : nullptr;
+    color[k] = trace_path(rays[k], (mask >> k) & 1, rec[k], world, env, lights,
+                          50, 3, vertices, spread);
+  }
+
+  for (int k = 0; features && k < n; k++) {
+    feature_sample& f = features[k];
+    if (!((mask >> k) & 1)) {
+      f.albedo = vec3(1, 1, 1);
+      f.normal = vec3(0, 0, 0);
+      f.depth = 0;
+      f.id = -1;
+      continue;
+    }
+    set_footprint(rec[k], rays[k], spread * t_max[k] * rays[k].direction().length());
+    f.albedo = material_albedo(rec[k].mat_ptr, rec[k]);
+    // a medium has no surface, its normal is made up
+    bool medium = rec[k].mat_ptr->kind == material_kind::isotropic;
+    f.normal = medium ? vec3(0, 0, 0) : unit_vector(rec[k].normal);
+    f.depth = t_max[k] * rays[k].direction().length();
+    f.id = rec[k].mat_ptr->id;
+  }
+}
+
+// the camera rays of packet_size neighbouring pixels are traced as one
+// packet. the image is the same as render() with trace_path as color().
+// pays off for coherent camera rays, e.g. a pinhole camera (aperture 0).
+void render_packets(framebuffer& fb, const camera& cam, hitable* world, int ns,
+                    background env, const hitable* lights = nullptr, int tile_size = 16) {
+  int ntx = (fb.nx + tile_size - 1) / tile_size;
+  int nty = (fb.ny + tile_size - 1) / tile_size;
+
+  render_pool().parallel_for(ntx*nty, [&](int tile) {
+    int i0 = (tile % ntx) * tile_size;
+    int j0 = (tile / ntx) * tile_size;
+    int i1 = std::min(i0 + tile_size, fb.nx);
+    int j1 = std::min(j0 + tile_size, fb.ny);
+    for (int j = j0; j < j1; j++) {
+      for (int i = i0; i < i1; i += packet_size) {
+        int n = std::min(packet_size, i1 - i);
+        int xs[packet_size];
+        vec3 colorx[packet_size];
+        for (int k = 0; k < n; k++) {
+          xs[k] = i + k;
+          colorx[k] = vec3(0, 0, 0);
+        }
+
+        for (int s = 0; s < ns; s++) {
+          vec3 c[packet_size];
+          feature_sample f[packet_size];
+          bool keep = fb.has_features();
+          trace_packet(fb, cam, world, env, lights, j, xs, n, s, c, keep ? f : nullptr);
+          for (int k = 0; k < n; k++) {
+            colorx[k] += c[k];
+            if (keep) fb.add_features(j*fb.nx + xs[k], f[k], c[k]);
+          }
+        }
+        for (int k = 0; k < n; k++) {
+          fb.sum[j*fb.nx + i + k] += colorx[k];
+          fb.count[j*fb.nx + i + k] += ns;
+        }
+      }
+    }
+  });
+}
+
+// the mean radiance as rgb floats, top row first, as image_io wants it
+std::vector<float> resolve(const framebuffer& fb) {
+  std::vector<float> rgb(3*fb.nx*fb.ny);
+  for (int j = 0; j < fb.ny; j++) {
+    for (int i = 0; i < fb.nx; i++) {
+      vec3 c = fb.color(i, j);
+      for (int k = 0; k < 3; k++)
+        rgb[3*((fb.ny-1-j)*fb.nx + i) + k] = c[k];
+    }
+  }
+  return rgb;
+}
+
+// binary ppm with gamma 2, e.g. to stdout
+bool write_ppm(FILE* f, const framebuffer& fb) {
+  return write_bytes(f, encode_ppm(resolve(fb).data(), fb.nx, fb.ny, 3, 2));
+}
+
+// format by extension, gamma 2 for ppm and png, linear pfm and exr
+bool write_image(const char* path, const framebuffer& fb) {
+  return write_image(path, resolve(fb).data(), fb.nx, fb.ny, 3, 2);
+}
+
+// the color and every feature buffer as one multi-channel exr, named
+// as compositors expect them. the pixel means, except for the id.
+bool write_aovs(const char* path, const framebuffer& fb) {
+  static const char* const names[] = {
+    "R", "G", "B", "albedo.R", "albedo.G", "albedo.B", "N.X", "N.Y", "N.Z",
+    "Z", "id", "path_length", "variance"
+  };
+  const int channels = sizeof(names) / sizeof(names[0]);
+  if (!fb.has_features()) {
+    std::cerr << "no aovs to write, call keep_features() before rendering\n";
+    return false;
+  }
+  std::vector<float> data(channels*fb.nx*fb.ny);
+  for (int j = 0; j < fb.ny; j++) {
+    for (int i = 0; i < fb.nx; i++) {
+      int p = j*fb.nx + i;
+      int m = fb.feature_count[p];
+      float inv = m > 0 ? 1.0f / m : 0;
+      vec3 c = fb.color(i, j);
+      vec3 a = fb.albedo[p] * inv;
+      vec3 n = fb.normal[p] * inv;
+      float l = luminance(c);
+      // of the pixel mean, as the denoiser takes it
+      float variance = m > 1 ? std::max(fb.moment[p] * inv - l*l, 0.0f) / m : 0;
+      float values[channels] = {
+        c[0], c[1], c[2], a[0], a[1], a[2], n[0], n[1], n[2],
+        fb.depth[p] * inv, static_cast<float>(fb.id[p]), fb.path_length[p] * inv, variance
+      };
+      // top row first
+      float* out = &data[channels*((fb.ny-1-j)*fb.nx + i)];
+      for (int k = 0; k < channels; k++) out[k] = values[k];
+    }
+  }
+  FILE* f = fopen(path, "wb");
+  if (!f) {
+    std::cerr << "cannot write " << path << "\n";
+    return false;
+  }
+  bool ok = write_bytes(f, encode_exr(data.data(), fb.nx, fb.ny, channels, names));
+  ok = fclose(f) == 0 && ok;
+  if (!ok) std::cerr << "cannot write " << path << "\n";
+  return ok;
+}
+
+#endif
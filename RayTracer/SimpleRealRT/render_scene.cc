@@ -0,0 +1,55 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include "arena.h"
+#include "render.h"
+#include "integrator.h"
+#include "denoise.h"
+#include "scene_file.h"
+
+// import image library stb_image, scene_file.h has its declarations
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+// render_scene file.scene > image.ppm renders a text or compiled scene,
+// -d denoises the image (a few dozen spp are enough then),
+// -a file.exr also writes the color and the aovs (albedo, normal,
+// depth, material id, path length, variance) for compositing.
+// render_scene -c file.scene file.bin compiles one.
+int main(int argc, char** argv) {
+  if (argc == 4 && strcmp(argv[1], "-c") == 0) {
+    scene_desc desc;
+    if (!load_scene(argv[2], desc)) return 1;
+    return write_scene_binary(argv[3], desc) ? 0 : 1;
+  }
+  bool denoised = false;
+  const char* aovs = nullptr;
+  int arg = 1;
+  for (; arg < argc - 1; arg++) {
+    if (strcmp(argv[arg], "-d") == 0) denoised = true;
+    else if (strcmp(argv[arg], "-a") == 0 && arg + 2 < argc) aovs = argv[++arg];
+    else break;
+  }
+  if (arg != argc - 1) {
+    std::cerr << "usage: " << argv[0] << " [-d] [-a aovs.exr] scene > image.ppm\n"
+              << "       " << argv[0] << " -c scene compiled\n";
+    return 1;
+  }
+  scene_desc desc;
+  if (!load_scene(argv[arg], desc)) return 1;
+
+  // everything the scene is built of, freed at once
+  arena scene;
+  hitable* lights;
+  hitable* world = build_scene(scene, desc, &lights);
+  if (!world) return 1;
+
+  const scene_settings& s = desc.settings;
+  camera cam = scene_camera(s);
+  framebuffer fb(s.nx, s.ny);
+  if (denoised || aovs) fb.keep_features();
+  render_packets(fb, cam, world, s.ns, s.background ? sky_background : black_background, lights);
+  if (aovs && !write_aovs(aovs, fb)) return 1;
+  write_ppm(stdout, denoised ? denoise(fb) : fb);
+  return 0;
+}
@@ -0,0 +1,315 @@
+#ifndef __SAMPLERH__
+#define __SAMPLERH__
+/*
+class sampler.
+counter-based random numbers. every number is addressed by
+(pixel, sample index, dimension), so its value does not depend on
+which thread draws it, or when.
+
+each thread owns one sampler, the render driver restarts it for
+every pixel sample and the camera, materials and media draw their
+dimensions from it in order, through random_float() for one and
+random_pair() for two dimensions.
+
+the samples of a pixel can come from
+  independent: hashed uniform numbers
+  halton: the halton sequence, a prime base per dimension, owen
+    scrambled per pixel
+  sobol: owen scrambled sobol points, a shuffled 1d or 2d sobol
+    sequence for each dimension (or pair), seeded per pixel (burley 2020)
+  blue_noise: the same sobol points for every pixel, each pixel
+    toroidally shifted by a blue noise mask, the error is blue noise
+    over the image (georgiev and fajardo 2016)
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+enum class sampling { independent, halton, sobol, blue_noise };
+
+// splitmix64 finalizer, a good 64 bit mixing function
+inline uint64_t mix_bits(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+inline uint32_t reverse_bits(uint32_t x) {
+  x = (x << 16) | (x >> 16);
+  x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+  x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+  x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+  x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+  return x;
+}
+
+// owen scrambling of the bits of x, from the top bit down, as a hash
+// (laine and karras 2011, constants from burley 2020)
+inline uint32_t owen_scramble(uint32_t x, uint32_t seed) {
+  x = reverse_bits(x);
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return reverse_bits(x);
+}
+
+// the first two sobol dimensions, as 32 bit fractions
+inline uint32_t sobol_0(uint32_t index) {
+  return reverse_bits(index);
+}
+
+inline uint32_t sobol_1(uint32_t index) {
+  uint32_t x = 0;
+  for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+    if (index & 1) x ^= v;
+  return x;
+}
+
+// top 24 bits, so the result never rounds up to 1
+inline float bits_to_float(uint32_t x) {
+  return static_cast<float>(x >> 8) * (1.0f / 16777216.0f);
+}
+
+// the radical inverse of index in base, every digit shifted by a
+// hash of the digits above it, which is an owen scramble
+inline float scrambled_radical_inverse(uint32_t index, int base, uint64_t seed) {
+  const float inv_base = 1.0f / base;
+  float inv = inv_base;
+  float result = 0;
+  uint64_t prefix = seed;
+  // 24 bits of precision, digits beyond add nothing
+  while (inv > 1.0f / 16777216.0f) {
+    int digit = index % base;
+    index /= base;
+    uint64_t h = mix_bits(prefix);
+    result += ((digit + h % base) % base) * inv;
+    prefix = mix_bits(prefix ^ (digit + 1));
+    inv *= inv_base;
+  }
+  return std::min(result, 1.0f - 1.0f / 16777216.0f);
+}
+
+const int halton_dimensions = 32;
+const int halton_primes[halton_dimensions] = {
+  2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+  59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131 };
+
+const int blue_noise_size = 64;
+
+// a 64x64 blue noise mask of the ranks 0..4095, by void and cluster
+// (ulichney 1993) on a torus with a gaussian energy of sigma 1.5
+std::vector<uint16_t> build_blue_noise_mask() {
+  const int n = blue_noise_size;
+  const int size = n*n;
+  // energy of one point, by toroidal offset
+  std::vector<float> kernel(size);
+  for (int y = 0; y < n; y++) {
+    for (int x = 0; x < n; x++) {
+      int dx = std::min(x, n - x), dy = std::min(y, n - y);
+      kernel[y*n + x] = std::exp(-(dx*dx + dy*dy) / (2 * 1.5f * 1.5f));
+    }
+  }
+  std::vector<char> ones(size, 0);
+  std::vector<float> energy(size, 0);
+  auto toggle = [&](int p, bool on) {
+    ones[p] = on;
+    int px = p % n, py = p / n;
+    for (int y = 0; y < n; y++)
+      for (int x = 0; x < n; x++)
+        energy[y*n + x] += (on ? 1 : -1) * kernel[((y - py + n) % n)*n + (x - px + n) % n];
+  };
+  // the tightest cluster among points of value v, or the largest void
+  auto extreme = [&](bool v, bool highest) {
+    int best = -1;
+    for (int p = 0; p < size; p++) {
+      if (ones[p] != v) continue;
+      if (best < 0 || (highest ? energy[p] > energy[best] : energy[p] < energy[best])) best = p;
+    }
+    return best;
+  };
+
+  // initial pattern: a tenth of the pixels, spread out by swapping
+  // the tightest cluster into the largest void until it is stable
+  uint64_t state = 0x5eed;
+  int initial = size / 10;
+  for (int k = 0; k < initial; ) {
+    int p = static_cast<int>(mix_bits(++state) % size);
+    if (!ones[p]) {
+      toggle(p, true);
+      k++;
+    }
+  }
+  for (;;) {
+    int cluster = extreme(true, true);
+    toggle(cluster, false);
+    int hole = extreme(false, false);
+    if (hole == cluster) {
+      toggle(cluster, true);
+      break;
+    }
+    toggle(hole, true);
+  }
+
+  std::vector<uint16_t> rank(size);
+  std::vector<char> prototype = ones;
+  std::vector<float> prototype_energy = energy;
+  // phase 1: rank the initial points, tightest clusters last
+  for (int r = initial - 1; r >= 0; r--) {
+    int p = extreme(true, true);
+    toggle(p, false);
+    rank[p] = r;
+  }
+  ones = prototype;
+  energy = prototype_energy;
+  // phase 2 and 3: fill the largest voids. past half full the
+  // minority pixels are the empty ones, which works out the same.
+  for (int r = initial; r < size; r++) {
+    int p = extreme(false, false);
+    toggle(p, true);
+    rank[p] = r;
+  }
+  return rank;
+}
+
+inline const std::vector<uint16_t>& blue_noise_mask() {
+  static const std::vector<uint16_t> mask = build_blue_noise_mask();
+  return mask;
+}
+
+// the kind of samples the samplers of all threads hand out
+inline sampling& sampling_mode() {
+  static sampling mode = sampling::sobol;
+  return mode;
+}
+
+class sampler {
+ public:
+  sampler() : seed(0), pixel_seed(0), dimension(0), index(0), x(0), y(0), mode(sampling::independent) {}
+
+  // start the random stream of one pixel sample
+  void start(int pixel, int sample_index) {
+    seed = mix_bits((static_cast<uint64_t>(pixel) << 32) ^ static_cast<uint32_t>(sample_index));
+    pixel_seed = mix_bits(static_cast<uint64_t>(pixel) + 0x632be59bd9b4e019ULL);
+    dimension = 0;
+    index = sample_index;
+    x = pixel % blue_noise_size;
+    y = pixel / blue_noise_size;
+    mode = sampling_mode();
+  }
+  // the same, pixel (x, y) of an image nx wide, the blue noise mask
+  // needs the position
+  void start(int px, int py, int nx, int sample_index) {
+    start(py*nx + px, sample_index);
+    x = px;
+    y = py;
+  }
+
+  // next dimension, uniform in [0, 1)
+  float next() {
+    dimension++;
+    switch (mode) {
+      case sampling::halton:
+        if (dimension <= halton_dimensions)
+          return scrambled_radical_inverse(index, halton_primes[dimension-1],
+                                           pixel_seed + dimension);
+        break;
+      case sampling::sobol:
+        return sobol_1d(index, mix_bits(pixel_seed + dimension));
+      case sampling::blue_noise:
+        return shift(sobol_1d(index, mix_bits(dimension)), 0);
+      default:
+        break;
+    }
+    return hashed();
+  }
+
+  // next two dimensions, as one 2d point
+  void next_2d(float& u, float& v) {
+    if (mode != sampling::sobol && mode != sampling::blue_noise) {
+      // consecutive halton bases are a good 2d set already
+      u = next();
+      v = next();
+      return;
+    }
+    dimension += 2;
+    uint64_t h = mix_bits(mode == sampling::sobol ? pixel_seed + dimension : dimension);
+    uint32_t i = owen_scramble(index, static_cast<uint32_t>(h));
+    u = bits_to_float(owen_scramble(sobol_0(i), static_cast<uint32_t>(h >> 32)));
+    v = bits_to_float(owen_scramble(sobol_1(i), static_cast<uint32_t>(h >> 16) ^ 0x9e3779b9u));
+    if (mode == sampling::blue_noise) {
+      u = shift(u, 0);
+      v = shift(v, 1);
+    }
+  }
+
+  uint64_t seed;
+  uint64_t pixel_seed;
+  uint64_t dimension;
+  uint32_t index;
+  int x, y;
+  sampling mode;
+
+ private:
+  float hashed() const {
+    uint64_t h = mix_bits(seed + 0x9e3779b97f4a7c15ULL * dimension);
+    return static_cast<float>(h >> 40) * (1.0f / 16777216.0f);
+  }
+  // a shuffled, scrambled van der corput sequence
+  static float sobol_1d(uint32_t i, uint64_t h) {
+    i = owen_scramble(i, static_cast<uint32_t>(h));
+    return bits_to_float(owen_scramble(sobol_0(i), static_cast<uint32_t>(h >> 32)));
+  }
+  // cranley-patterson rotation by the mask, read at an offset that
+  // differs per dimension so the dimensions stay uncorrelated
+  float shift(float u, int k) const {
+    uint64_t h = mix_bits(dimension * 2 + k);
+    int mx = (x + static_cast<int>(h & 63)) & (blue_noise_size - 1);
+    int my = (y + static_cast<int>((h >> 6) & 63)) & (blue_noise_size - 1);
+    float offset = (blue_noise_mask()[my*blue_noise_size + mx] + 0.5f) / (blue_noise_size*blue_noise_size);
+    u += offset;
+    return u >= 1 ? u - 1 : u;
+  }
+};
+
+// a square point to the unit disk, keeping its strata (shirley and chiu 1997)
+inline void concentric_disk(float u, float v, float& dx, float& dy) {
+  float a = 2*u - 1;
+  float b = 2*v - 1;
+  if (a == 0 && b == 0) {
+    dx = dy = 0;
+    return;
+  }
+  float r, phi;
+  if (a*a > b*b) {
+    r = a;
+    phi = (M_PI / 4) * (b / a);
+  } else {
+    r = b;
+    phi = M_PI/2 - (M_PI / 4) * (a / b);
+  }
+  dx = r * std::cos(phi);
+  dy = r * std::sin(phi);
+}
+
+inline sampler& thread_sampler() {
+  static thread_local sampler s;
+  return s;
+}
+
+inline float random_float() {
+  return thread_sampler().next();
+}
+
+// two dimensions that belong together, e.g. a point on the lens
+inline void random_pair(float& u, float& v) {
+  thread_sampler().next_2d(u, v);
+}
+
+#endif
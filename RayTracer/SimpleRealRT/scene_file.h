@@ -0,0 +1,751 @@
+#ifndef __SCENEFILEH__
+#define __SCENEFILEH__
+/*
+scene files.
+a scene as text, one statement per line, '#' starts a comment:
+
+  image 1200 800 50                  # width, height, spp
+  background black                   # or sky
+  camera 278 278 -800  278 278 0  0 1 0  40 0 10  [0 1]
+                                     # from, at, up, vfov, aperture, focus, [time0 time1]
+  texture <name> constant r g b | checker even odd | image path
+                 | value_noise scale | perlin_noise scale [type]
+  material <name> lambertian tex | metal r g b fuzz | dielectric ior
+                  | diffuse_light tex | isotropic tex
+  shape <name> sphere x y z radius mat
+               | moving_sphere x0 y0 z0 x1 y1 z1 time0 time1 radius mat
+               | xy_rect x0 x1 y0 y1 z mat | xz_rect .. | yz_rect ..
+               | block x0 y0 z0 x1 y1 z1 mat | mesh file.obj mat
+               | flip_normals shape | constant_medium shape density tex
+               | instance shape [translate x y z] [rotate_y deg]
+                                [rotate x y z deg] [scale x y z] ...
+  add <shape> ...                    # into the world
+  light <shape> ...                  # into the world, and sampled directly;
+                                     # a sphere, a rect or a flip_normals of one
+
+the transforms of an instance multiply as written, like the affine
+products in the scene functions: the rightmost one applies first.
+
+every statement becomes a fixed size scene_item with the names
+resolved to indices, so a parsed scene is a few flat arrays. the
+compiled form writes those arrays, the strings and the meshes (already
+in leaf order, with their bvh) to one file; reading it back maps the
+file and copies the arrays out, nothing is tokenized or rebuilt.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "arena.h"
+#include "aarect.h"
+#include "block.h"
+#include "camera.h"
+#include "constant_medium.h"
+#include "hitable_list.h"
+#include "instance.h"
+#include "integrator.h"
+#include "linear_bvh.h"
+#include "material.h"
+#include "mesh.h"
+#include "sphere.h"
+#include "stb_image.h"
+#include "texture.h"
+
+enum class scene_item_kind : int32_t {
+  // textures
+  constant, checker, image, value_noise, perlin_noise,
+  // materials
+  lambertian, metal, dielectric, diffuse_light, isotropic,
+  // shapes
+  sphere, moving_sphere, xy_rect, xz_rect, yz_rect, block, mesh,
+  flip_normals, constant_medium, instance
+};
+
+// one texture, material or shape. ref holds the indices of the
+// textures, materials or shapes it uses, a string offset (image) or a
+// mesh index (mesh). an instance keeps its 3x4 matrix in f.
+struct scene_item {
+  scene_item_kind kind;
+  int32_t ref[3];
+  float f[12];
+};
+
+static_assert(sizeof(scene_item) == 64, "scene_item should be 64 bytes");
+
+struct scene_settings {
+  int32_t nx, ny, ns;
+  // 0 black, 1 sky
+  int32_t background;
+  float lookfrom[3], lookat[3], vup[3];
+  float vfov, aperture, focus, time0, time1;
+};
+
+struct scene_desc {
+  scene_settings settings;
+  std::vector<scene_item> textures;
+  std::vector<scene_item> materials;
+  std::vector<scene_item> shapes;
+  // indices into shapes
+  std::vector<int32_t> world;
+  std::vector<int32_t> lights;
+  // NUL terminated strings, ref into it by offset
+  std::vector<char> strings;
+  std::vector<mesh_data> meshes;
+  // empty for a text scene, the meshes build their own then
+  std::vector<flat_bvh> trees;
+};
+
+// only these implement pdf_value and random, a light of any other
+// shape would be sampled with a zero pdf. flip_normals refers to an
+// earlier shape, so the walk ends.
+bool sampleable_shape(const scene_desc& desc, int32_t r) {
+  while (desc.shapes[r].kind == scene_item_kind::flip_normals) r = desc.shapes[r].ref[0];
+  scene_item_kind k = desc.shapes[r].kind;
+  return k == scene_item_kind::sphere || k == scene_item_kind::xy_rect ||
+         k == scene_item_kind::xz_rect || k == scene_item_kind::yz_rect;
+}
+
+namespace scene_text {
+
+struct statement {
+  const char* keyword;
+  scene_item_kind kind;
+  // f float, F optional float, t texture, m material, s shape,
+  // p image path, o obj file
+  const char* args;
+};
+
+const statement textures[] = {
+  { "constant", scene_item_kind::constant, "fff" },
+  { "checker", scene_item_kind::checker, "tt" },
+  { "image", scene_item_kind::image, "p" },
+  { "value_noise", scene_item_kind::value_noise, "f" },
+  { "perlin_noise", scene_item_kind::perlin_noise, "fF" },
+};
+
+const statement materials[] = {
+  { "lambertian", scene_item_kind::lambertian, "t" },
+  { "metal", scene_item_kind::metal, "ffff" },
+  { "dielectric", scene_item_kind::dielectric, "f" },
+  { "diffuse_light", scene_item_kind::diffuse_light, "t" },
+  { "isotropic", scene_item_kind::isotropic, "t" },
+};
+
+const statement shapes[] = {
+  { "sphere", scene_item_kind::sphere, "ffffm" },
+  { "moving_sphere", scene_item_kind::moving_sphere, "fffffffffm" },
+  { "xy_rect", scene_item_kind::xy_rect, "fffffm" },
+  { "xz_rect", scene_item_kind::xz_rect, "fffffm" },
+  { "yz_rect", scene_item_kind::yz_rect, "fffffm" },
+  { "block", scene_item_kind::block, "ffffffm" },
+  { "mesh", scene_item_kind::mesh, "om" },
+  { "flip_normals", scene_item_kind::flip_normals, "s" },
+  { "constant_medium", scene_item_kind::constant_medium, "sft" },
+  { "instance", scene_item_kind::instance, "s" },
+};
+
+// the state of one parse, names to indices for every table
+struct parser {
+  parser(scene_desc& d, const char* p) : desc(d), path(p), line_number(0) {}
+
+  scene_desc& desc;
+  const char* path;
+  int line_number;
+  std::map<std::string, int> texture_names, material_names, shape_names;
+
+  bool error(const std::string& what) {
+    std::cerr << path << ":" << line_number << ": " << what << "\n";
+    return false;
+  }
+  bool name(std::istringstream& in, const std::map<std::string, int>& names,
+            const char* table, int32_t& index) {
+    std::string s;
+    if (!(in >> s)) return error(std::string("missing ") + table);
+    auto it = names.find(s);
+    if (it == names.end()) return error(std::string("unknown ") + table + " " + s);
+    index = it->second;
+    return true;
+  }
+  // false only when something is there but is not a number, v stays
+  // as it is when the line has ended
+  bool optional_number(std::istringstream& in, float& v) {
+    in >> std::ws;
+    if (in.eof()) return true;
+    return static_cast<bool>(in >> v);
+  }
+  bool item(std::istringstream& in, const statement* table, int n, scene_item& it);
+  bool transforms(std::istringstream& in, scene_item& it);
+  bool line(const std::string& text);
+};
+
+bool parser::item(std::istringstream& in, const statement* table, int n, scene_item& it) {
+  std::string keyword;
+  in >> keyword;
+  const statement* s = nullptr;
+  for (int k = 0; k < n; k++)
+    if (keyword == table[k].keyword) s = &table[k];
+  if (!s) return error("unknown kind " + keyword);
+  memset(&it, 0, sizeof(it));
+  it.kind = s->kind;
+  int nf = 0, nref = 0;
+  for (const char* a = s->args; *a; a++) {
+    switch (*a) {
+      case 'f':
+        if (!(in >> it.f[nf++])) return error("missing number for " + keyword);
+        break;
+      case 'F':
+        if (!optional_number(in, it.f[nf++])) return error("bad number for " + keyword);
+        break;
+      case 't':
+        if (!name(in, texture_names, "texture", it.ref[nref++])) return false;
+        break;
+      case 'm':
+        if (!name(in, material_names, "material", it.ref[nref++])) return false;
+        break;
+      case 's':
+        if (!name(in, shape_names, "shape", it.ref[nref++])) return false;
+        break;
+      case 'p': {
+        std::string file;
+        if (!(in >> file)) return error("missing file for " + keyword);
+        it.ref[nref++] = static_cast<int32_t>(desc.strings.size());
+        desc.strings.insert(desc.strings.end(), file.begin(), file.end());
+        desc.strings.push_back(0);
+        break;
+      }
+      case 'o': {
+        std::string file;
+        if (!(in >> file)) return error("missing file for " + keyword);
+        mesh_data m;
+        if (!load_obj(file.c_str(), m)) return error("cannot load mesh " + file);
+        if (m.normal_index.empty()) m.compute_normals();
+        it.ref[nref++] = static_cast<int32_t>(desc.meshes.size());
+        desc.meshes.push_back(std::move(m));
+        break;
+      }
+    }
+  }
+  return true;
+}
+
+bool parser::transforms(std::istringstream& in, scene_item& it) {
+  affine m;
+  std::string op;
+  while (in >> op) {
+    float x, y, z, d;
+    if (op == "translate" && in >> x >> y >> z) {
+      m = m * affine::translation(vec3(x, y, z));
+    } else if (op == "scale" && in >> x >> y >> z) {
+      m = m * affine::scaling(vec3(x, y, z));
+    } else if (op == "rotate_y" && in >> d) {
+      m = m * affine::rotation_y(d);
+    } else if (op == "rotate" && in >> x >> y >> z >> d) {
+      m = m * affine::rotation(vec3(x, y, z), d);
+    } else {
+      return error("bad transform " + op);
+    }
+  }
+  memcpy(it.f, m.m, sizeof(m.m));
+  return true;
+}
+
+bool parser::line(const std::string& text) {
+  std::istringstream in(text.substr(0, text.find('#')));
+  std::string keyword;
+  if (!(in >> keyword)) return true;
+  scene_settings& s = desc.settings;
+  if (keyword == "image") {
+    if (!(in >> s.nx >> s.ny >> s.ns)) return error("image wants width, height and spp");
+    if (s.nx <= 0 || s.ny <= 0 || s.ns <= 0) return error("image sizes and spp must be positive");
+  } else if (keyword == "background") {
+    std::string b;
+    in >> b;
+    if (b != "black" && b != "sky") return error("background is black or sky");
+    s.background = b == "sky";
+  } else if (keyword == "camera") {
+    float* f[] = { &s.lookfrom[0], &s.lookfrom[1], &s.lookfrom[2],
+                   &s.lookat[0], &s.lookat[1], &s.lookat[2],
+                   &s.vup[0], &s.vup[1], &s.vup[2], &s.vfov, &s.aperture, &s.focus };
+    for (float* v : f)
+      if (!(in >> *v)) return error("camera wants from, at, up, vfov, aperture and focus");
+    // the shutter times come both or not at all
+    in >> std::ws;
+    if (!in.eof()) {
+      float t0, t1;
+      if (!(in >> t0 >> t1)) return error("camera wants time0 and time1 after focus");
+      s.time0 = t0;
+      s.time1 = t1;
+    }
+  } else if (keyword == "texture" || keyword == "material" || keyword == "shape") {
+    std::string n;
+    if (!(in >> n)) return error(keyword + " wants a name");
+    scene_item it;
+    if (keyword == "texture") {
+      if (!item(in, textures, sizeof(textures) / sizeof(statement), it)) return false;
+      texture_names[n] = static_cast<int>(desc.textures.size());
+      desc.textures.push_back(it);
+    } else if (keyword == "material") {
+      if (!item(in, materials, sizeof(materials) / sizeof(statement), it)) return false;
+      material_names[n] = static_cast<int>(desc.materials.size());
+      desc.materials.push_back(it);
+    } else {
+      if (!item(in, shapes, sizeof(shapes) / sizeof(statement), it)) return false;
+      if (it.kind == scene_item_kind::instance && !transforms(in, it)) return false;
+      shape_names[n] = static_cast<int>(desc.shapes.size());
+      desc.shapes.push_back(it);
+    }
+  } else if (keyword == "add" || keyword == "light") {
+    std::string n;
+    if (!(in >> std::ws) || in.eof()) return error(keyword + " wants shapes");
+    while (in >> n) {
+      auto it = shape_names.find(n);
+      if (it == shape_names.end()) return error("unknown shape " + n);
+      if (keyword == "light" && !sampleable_shape(desc, it->second))
+        return error("cannot sample light " + n);
+      desc.world.push_back(it->second);
+      if (keyword == "light") desc.lights.push_back(it->second);
+    }
+  } else {
+    return error("unknown statement " + keyword);
+  }
+  // every statement reads all it wants, anything left is a mistake
+  std::string extra;
+  if (in >> extra) return error("unexpected " + extra);
+  return true;
+}
+
+}  // namespace scene_text
+
+// the defaults are those of the cornell box scenes
+void default_settings(scene_settings& s) {
+  s.nx = 1200;
+  s.ny = 800;
+  s.ns = 50;
+  s.background = 0;
+  float from[3] = { 278, 278, -800 }, at[3] = { 278, 278, 0 }, up[3] = { 0, 1, 0 };
+  memcpy(s.lookfrom, from, sizeof(from));
+  memcpy(s.lookat, at, sizeof(at));
+  memcpy(s.vup, up, sizeof(up));
+  s.vfov = 40;
+  s.aperture = 0;
+  s.focus = 10;
+  s.time0 = 0;
+  s.time1 = 1;
+}
+
+bool parse_scene(const char* path, scene_desc& desc) {
+  std::ifstream file(path);
+  if (!file) {
+    std::cerr << "cannot open " << path << "\n";
+    return false;
+  }
+  desc = scene_desc();
+  default_settings(desc.settings);
+  scene_text::parser p(desc, path);
+  std::string text;
+  while (std::getline(file, text)) {
+    p.line_number++;
+    if (!p.line(text)) return false;
+  }
+  if (desc.world.empty()) return p.error("the scene is empty");
+  return true;
+}
+
+// the compiled form, native byte order. every section starts at a
+// multiple of 8 bytes.
+const char scene_magic[8] = { 'G', 'T', 'S', 'C', 'E', 'N', 'E', '1' };
+
+struct scene_file_header {
+  char magic[8];
+  scene_settings settings;
+  int32_t textures, materials, shapes, world, lights, strings, meshes;
+  int32_t pad;
+};
+
+// followed by positions, normals, uvs, the index arrays and the nodes
+struct scene_file_mesh {
+  int32_t positions, normals, uvs, triangles;
+  int32_t has_normal_index, has_uv_index, nodes, pad;
+};
+
+namespace scene_binary {
+
+template <class T>
+void write(FILE* f, const T* p, size_t n) {
+  static const char zero[8] = { 0 };
+  if (n) fwrite(p, sizeof(T), n, f);
+  fwrite(zero, 1, (8 - (n * sizeof(T)) % 8) % 8, f);
+}
+
+// a bounds checked cursor through the mapping
+struct reader {
+  const char* p;
+  const char* end;
+  template <class T>
+  const T* take(size_t n) {
+    size_t bytes = n * sizeof(T);
+    size_t padded = bytes + (8 - bytes % 8) % 8;
+    if (static_cast<size_t>(end - p) < padded) return nullptr;
+    const T* t = reinterpret_cast<const T*>(p);
+    p += padded;
+    return t;
+  }
+  template <class T>
+  bool copy(std::vector<T>& v, size_t n) {
+    const T* t = take<T>(n);
+    if (!t) return false;
+    v.assign(t, t + n);
+    return true;
+  }
+};
+
+}  // namespace scene_binary
+
+// meshes are written in leaf order with their bvh, built here when the
+// scene came from text
+bool write_scene_binary(const char* path, const scene_desc& desc) {
+  FILE* f = fopen(path, "wb");
+  if (!f) {
+    std::cerr << "cannot write " << path << "\n";
+    return false;
+  }
+  scene_file_header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, scene_magic, sizeof(h.magic));
+  h.settings = desc.settings;
+  h.textures = desc.textures.size();
+  h.materials = desc.materials.size();
+  h.shapes = desc.shapes.size();
+  h.world = desc.world.size();
+  h.lights = desc.lights.size();
+  h.strings = desc.strings.size();
+  h.meshes = desc.meshes.size();
+  using scene_binary::write;
+  write(f, &h, 1);
+  write(f, desc.textures.data(), desc.textures.size());
+  write(f, desc.materials.data(), desc.materials.size());
+  write(f, desc.shapes.data(), desc.shapes.size());
+  write(f, desc.world.data(), desc.world.size());
+  write(f, desc.lights.data(), desc.lights.size());
+  write(f, desc.strings.data(), desc.strings.size());
+  for (size_t k = 0; k < desc.meshes.size(); k++) {
+    const mesh_data* m = &desc.meshes[k];
+    const flat_bvh* tree = k < desc.trees.size() ? &desc.trees[k] : nullptr;
+    arena scratch;
+    if (!tree) {
+      triangle_mesh* built = scratch.make<triangle_mesh>(*m, nullptr);
+      m = &built->mesh;
+      tree = &built->tree;
+    }
+    scene_file_mesh fm;
+    memset(&fm, 0, sizeof(fm));
+    fm.positions = m->positions.size();
+    fm.normals = m->normals.size();
+    fm.uvs = m->uvs.size();
+    fm.triangles = m->triangles();
+    fm.has_normal_index = !m->normal_index.empty();
+    fm.has_uv_index = !m->uv_index.empty();
+    fm.nodes = tree->nodes.size();
+    write(f, &fm, 1);
+    write(f, m->positions.data(), m->positions.size());
+    write(f, m->normals.data(), m->normals.size());
+    write(f, m->uvs.data(), m->uvs.size());
+    write(f, m->position_index.data(), m->position_index.size());
+    write(f, m->normal_index.data(), m->normal_index.size());
+    write(f, m->uv_index.data(), m->uv_index.size());
+    write(f, tree->nodes.data(), tree->nodes.size());
+  }
+  bool ok = !ferror(f);
+  if (fclose(f) != 0 || !ok) {
+    std::cerr << "cannot write " << path << "\n";
+    return false;
+  }
+  return true;
+}
+
+// the indices of the triangles and the nodes of the tree in range, a
+// compiled mesh is traced as it is read
+bool valid_mesh(const mesh_data& m, const flat_bvh& tree) {
+  size_t n = m.position_index.size();
+  if (n % 3 != 0 || m.uvs.size() % 2 != 0) return false;
+  if (!m.normal_index.empty() && m.normal_index.size() != n) return false;
+  if (!m.uv_index.empty() && m.uv_index.size() != n) return false;
+  int positions = m.positions.size(), normals = m.normals.size(), uvs = m.uvs.size() / 2;
+  for (size_t k = 0; k < n; k++) {
+    if (m.position_index[k] < 0 || m.position_index[k] >= positions) return false;
+    if (!m.normal_index.empty() && (m.normal_index[k] < -1 || m.normal_index[k] >= normals))
+      return false;
+    if (!m.uv_index.empty() && (m.uv_index[k] < -1 || m.uv_index[k] >= uvs)) return false;
+  }
+  // leaves in the triangles, second children after their parent
+  int nodes = tree.nodes.size(), triangles = m.triangles();
+  if (triangles > 0 && nodes == 0) return false;
+  for (int k = 0; k < nodes; k++) {
+    const linear_bvh_node& node = tree.nodes[k];
+    if (node.nprims > 0) {
+      if (node.offset < 0 || node.offset + node.nprims > triangles) return false;
+    } else if (node.offset <= k || node.offset >= nodes) {
+      return false;
+    }
+  }
+  // every node reached once, no deeper than the traversal stacks
+  std::vector<char> seen(nodes, 0);
+  std::vector<std::pair<int, int>> stack;
+  if (nodes > 0) stack.push_back(std::make_pair(0, 0));
+  while (!stack.empty()) {
+    int k = stack.back().first, level = stack.back().second;
+    stack.pop_back();
+    if (seen[k]) return false;
+    seen[k] = 1;
+    const linear_bvh_node& node = tree.nodes[k];
+    if (node.nprims > 0) continue;
+    if (level + 1 > bvh_stack_size) return false;
+    stack.push_back(std::make_pair(k + 1, level + 1));
+    stack.push_back(std::make_pair(node.offset, level + 1));
+  }
+  return true;
+}
+
+// every reference of every item in range, for files not written by
+// the parser
+bool valid_scene(const scene_desc& desc) {
+  using namespace scene_text;
+  const statement* tables[] = { textures, materials, shapes };
+  const int sizes[] = { sizeof(textures) / sizeof(statement),
+                        sizeof(materials) / sizeof(statement),
+                        sizeof(shapes) / sizeof(statement) };
+  const std::vector<scene_item>* items[] = { &desc.textures, &desc.materials, &desc.shapes };
+  for (int table = 0; table < 3; table++) {
+    for (size_t i = 0; i < items[table]->size(); i++) {
+      const scene_item& it = (*items[table])[i];
+      const statement* s = nullptr;
+      for (int k = 0; k < sizes[table]; k++)
+        if (tables[table][k].kind == it.kind) s = &tables[table][k];
+      if (!s) return false;
+      int nref = 0;
+      for (const char* a = s->args; *a; a++) {
+        size_t count;
+        switch (*a) {
+          case 't': count = table == 0 ? i : desc.textures.size(); break;
+          case 'm': count = desc.materials.size(); break;
+          // earlier shapes only
+          case 's': count = i; break;
+          case 'p': count = desc.strings.size(); break;
+          case 'o': count = desc.meshes.size(); break;
+          default: continue;
+        }
+        int32_t r = it.ref[nref++];
+        if (r < 0 || static_cast<size_t>(r) >= count) return false;
+      }
+    }
+  }
+  for (int32_t r : desc.world)
+    if (r < 0 || static_cast<size_t>(r) >= desc.shapes.size()) return false;
+  for (int32_t r : desc.lights)
+    if (r < 0 || static_cast<size_t>(r) >= desc.shapes.size() || !sampleable_shape(desc, r))
+      return false;
+  for (size_t k = 0; k < desc.meshes.size(); k++)
+    if (k < desc.trees.size() && !valid_mesh(desc.meshes[k], desc.trees[k])) return false;
+  const scene_settings& s = desc.settings;
+  if (s.nx <= 0 || s.ny <= 0 || s.ns <= 0) return false;
+  return !desc.world.empty() && (desc.strings.empty() || desc.strings.back() == 0);
+}
+
+bool read_scene_binary(const char* path, scene_desc& desc) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    if (fd >= 0) close(fd);
+    std::cerr << "cannot open " << path << "\n";
+    return false;
+  }
+  void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    std::cerr << "cannot map " << path << "\n";
+    return false;
+  }
+  desc = scene_desc();
+  const char* base = static_cast<const char*>(map);
+  scene_binary::reader in = { base, base + st.st_size };
+  const scene_file_header* h = in.take<scene_file_header>(1);
+  bool ok = h && memcmp(h->magic, scene_magic, sizeof(scene_magic)) == 0 &&
+            h->textures >= 0 && h->materials >= 0 && h->shapes >= 0 && h->world >= 0 &&
+            h->lights >= 0 && h->strings >= 0 && h->meshes >= 0;
+  if (ok) {
+    desc.settings = h->settings;
+    ok = in.copy(desc.textures, h->textures) && in.copy(desc.materials, h->materials) &&
+         in.copy(desc.shapes, h->shapes) && in.copy(desc.world, h->world) &&
+         in.copy(desc.lights, h->lights) && in.copy(desc.strings, h->strings);
+    desc.meshes.resize(ok ? h->meshes : 0);
+    desc.trees.resize(ok ? h->meshes : 0);
+    for (int k = 0; ok && k < h->meshes; k++) {
+      const scene_file_mesh* fm = in.take<scene_file_mesh>(1);
+      mesh_data& m = desc.meshes[k];
+      ok = fm && fm->positions >= 0 && fm->normals >= 0 && fm->uvs >= 0 &&
+           fm->triangles >= 0 && fm->triangles < (1 << 29) && fm->nodes >= 0 &&
+           in.copy(m.positions, fm->positions) && in.copy(m.normals, fm->normals) &&
+           in.copy(m.uvs, fm->uvs) && in.copy(m.position_index, 3 * fm->triangles) &&
+           in.copy(m.normal_index, fm->has_normal_index ? 3 * fm->triangles : 0) &&
+           in.copy(m.uv_index, fm->has_uv_index ? 3 * fm->triangles : 0) &&
+           in.copy(desc.trees[k].nodes, fm->nodes);
+    }
+  }
+  munmap(map, st.st_size);
+  ok = ok && valid_scene(desc);
+  if (!ok) std::cerr << path << ": not a compiled scene, or truncated\n";
+  return ok;
+}
+
+// text or compiled, told apart by the magic
+bool load_scene(const char* path, scene_desc& desc) {
+  char magic[sizeof(scene_magic)] = { 0 };
+  FILE* f = fopen(path, "rb");
+  if (f) {
+    size_t n = fread(magic, 1, sizeof(magic), f);
+    fclose(f);
+    if (n == sizeof(magic) && memcmp(magic, scene_magic, sizeof(magic)) == 0)
+      return read_scene_binary(path, desc);
+  }
+  return parse_scene(path, desc);
+}
+
+// the hitable graph of a scene, everything in the arena. the references
+// of an item always point to earlier items, so one pass builds them all.
+hitable* build_scene(arena& scene, const scene_desc& desc, hitable** lights) {
+  std::vector<texture*> textures;
+  std::vector<material*> materials;
+  std::vector<hitable*> shapes;
+  auto vec = [](const float* f) { return vec3(f[0], f[1], f[2]); };
+  for (const scene_item& it : desc.textures) {
+    texture* t = nullptr;
+    switch (it.kind) {
+      case scene_item_kind::constant:
+        t = scene.make<constant_texture>(vec(it.f));
+        break;
+      case scene_item_kind::checker:
+        t = scene.make<checker_texture>(textures[it.ref[0]], textures[it.ref[1]]);
+        break;
+      case scene_item_kind::image: {
+        const char* file = &desc.strings[it.ref[0]];
+        int nx, ny, nn;
+        unsigned char* data = stbi_load(file, &nx, &ny, &nn, 0);
+        if (!data) {
+          std::cerr << "cannot load image " << file << "\n";
+          return nullptr;
+        }
+        t = scene.make<image_texture>(data, nx, ny, nn);
+        stbi_image_free(data);
+        break;
+      }
+      case scene_item_kind::value_noise:
+        t = scene.make<value_noise_texture>(it.f[0]);
+        break;
+      default:
+        t = scene.make<perlin_noise_texture>(it.f[0], static_cast<int>(it.f[1]));
+        break;
+    }
+    textures.push_back(t);
+  }
+  for (const scene_item& it : desc.materials) {
+    material* m = nullptr;
+    switch (it.kind) {
+      case scene_item_kind::lambertian:
+        m = scene.make<lambertian>(textures[it.ref[0]]);
+        break;
+      case scene_item_kind::metal:
+        m = scene.make<metal>(vec(it.f), it.f[3]);
+        break;
+      case scene_item_kind::dielectric:
+        m = scene.make<dielectric>(it.f[0]);
+        break;
+      case scene_item_kind::diffuse_light:
+        m = scene.make<diffuse_light>(textures[it.ref[0]]);
+        break;
+      default:
+        m = scene.make<isotropic>(textures[it.ref[0]]);
+        break;
+    }
+    materials.push_back(m);
+  }
+  for (const scene_item& it : desc.shapes) {
+    const float* f = it.f;
+    hitable* h = nullptr;
+    switch (it.kind) {
+      case scene_item_kind::sphere:
+        h = scene.make<sphere>(vec(f), f[3], materials[it.ref[0]]);
+        break;
+      case scene_item_kind::moving_sphere:
+        h = scene.make<moving_sphere>(vec(f), vec(f + 3), f[6], f[7], f[8], materials[it.ref[0]]);
+        break;
+      case scene_item_kind::xy_rect:
+        h = scene.make<xy_rect>(f[0], f[1], f[2], f[3], f[4], materials[it.ref[0]]);
+        break;
+      case scene_item_kind::xz_rect:
+        h = scene.make<xz_rect>(f[0], f[1], f[2], f[3], f[4], materials[it.ref[0]]);
+        break;
+      case scene_item_kind::yz_rect:
+        h = scene.make<yz_rect>(f[0], f[1], f[2], f[3], f[4], materials[it.ref[0]]);
+        break;
+      case scene_item_kind::block:
+        h = scene.make<block>(vec(f), vec(f + 3), materials[it.ref[0]], &scene);
+        break;
+      case scene_item_kind::mesh:
+        if (static_cast<size_t>(it.ref[0]) < desc.trees.size())
+          h = scene.make<triangle_mesh>(desc.meshes[it.ref[0]], desc.trees[it.ref[0]],
+                                        materials[it.ref[1]]);
+        else
+          h = scene.make<triangle_mesh>(desc.meshes[it.ref[0]], materials[it.ref[1]]);
+        break;
+      case scene_item_kind::flip_normals:
+        h = scene.make<flip_normals>(shapes[it.ref[0]]);
+        break;
+      case scene_item_kind::constant_medium:
+        h = scene.make<constant_medium>(shapes[it.ref[0]], f[0], textures[it.ref[1]], &scene);
+        break;
+      default: {
+        affine m;
+        memcpy(m.m, f, sizeof(m.m));
+        h = scene.make<instance>(shapes[it.ref[0]], m);
+        break;
+      }
+    }
+    shapes.push_back(h);
+  }
+
+  int n = static_cast<int>(desc.world.size());
+  hitable** list = scene.make_array<hitable*>(n);
+  for (int k = 0; k < n; k++) list[k] = shapes[desc.world[k]];
+  *lights = nullptr;
+  int nl = static_cast<int>(desc.lights.size());
+  if (nl == 1) {
+    *lights = shapes[desc.lights[0]];
+  } else if (nl > 1) {
+    hitable** l = scene.make_array<hitable*>(nl);
+    for (int k = 0; k < nl; k++) l[k] = shapes[desc.lights[k]];
+    *lights = scene.make<hitable_list>(l, nl);
+  }
+  const scene_settings& s = desc.settings;
+  return scene.make<linear_bvh>(list, n, s.time0, s.time1);
+}
+
+camera scene_camera(const scene_settings& s) {
+  vec3 lookfrom(s.lookfrom[0], s.lookfrom[1], s.lookfrom[2]);
+  vec3 lookat(s.lookat[0], s.lookat[1], s.lookat[2]);
+  vec3 vup(s.vup[0], s.vup[1], s.vup[2]);
+  return camera(lookfrom, lookat, vup, s.vfov, float(s.nx) / float(s.ny),
+                s.aperture, s.focus, s.time0, s.time1);
+}
+
+#endif
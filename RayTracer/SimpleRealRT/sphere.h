@@ -4,8 +4,17 @@
 hitable class sphere.
  */
 
+#include <algorithm>
 #include <cmath>
 #include "hitable.h"
+#include "onb.h"
+#include "sampler.h"
+
+// u runs around 2 pi r sin(theta), v over pi r, at the unit normal n
+inline float sphere_uv_scale(const vec3& n, float radius) {
+  float sin_theta = sqrt(std::max(1 - n.y()*n.y(), 1e-6f));
+  return 1 / (M_PI * radius * sqrt(2 * sin_theta));
+}
 
 class sphere: public hitable {
  public:
@@ -13,6 +22,10 @@ class sphere: public hitable {
   sphere(vec3 cen, float r, material* m) : center(cen), radius(r), mat_ptr(m) {}
   virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const;
   virtual bool bounding_box(float t0, float t1, aabb& box) const;
+  virtual int hit_packet(const ray_packet& p, int active, float t_min,
+                         float* t_max, hit_record* rec) const;
+  virtual float pdf_value(const vec3& o, const vec3& v) const;
+  virtual vec3 random(const vec3& o) const;
   static void get_uv(const vec3& p, float& u, float& v);
   vec3 center;
   float radius;
@@ -48,6 +61,7 @@ bool sphere::hit(const ray &r, float t_min, float t_max, hit_record &rec) const
       rec.p = r.point_at_parameter(rec.t);
       get_uv((rec.p-center)/radius, rec.u, rec.v);
       rec.normal = (rec.p - center) / radius;
+      rec.uv_scale = sphere_uv_scale(rec.normal, radius);
       rec.mat_ptr = mat_ptr;
       return true;
     }
@@ -58,6 +72,7 @@ bool sphere::hit(const ray &r, float t_min, float t_max, hit_record &rec) const
       rec.p = r.point_at_parameter(rec.t);
       get_uv((rec.p-center)/radius, rec.u, rec.v);
       rec.normal = (rec.p - center) / radius;
+      rec.uv_scale = sphere_uv_scale(rec.normal, radius);
       rec.mat_ptr = mat_ptr;
       return true;
     }
@@ -65,6 +80,66 @@ bool sphere::hit(const ray &r, float t_min, float t_max, hit_record &rec) const
   return false;
 }
 
+// uniform over the cone of directions from o to the sphere
+float sphere::pdf_value(const vec3& o, const vec3& v) const {
+  hit_record rec;
+  float distance_squared = (center - o).squared_length();
+  // no cone from inside
+  if (distance_squared <= radius*radius) return 0;
+  if (!hit(ray(o, v), 0.001, FLT_MAX, rec)) return 0;
+  float cos_theta_max = sqrt(1 - radius*radius / distance_squared);
+  float solid_angle = 2*M_PI*(1 - cos_theta_max);
+  return 1 / solid_angle;
+}
+
+vec3 sphere::random(const vec3& o) const {
+  vec3 direction = center - o;
+  float distance_squared = direction.squared_length();
+  if (distance_squared <= radius*radius) return direction;
+  float r1, r2;
+  random_pair(r1, r2);
+  float z = 1 + r2*(sqrt(1 - radius*radius / distance_squared) - 1);
+  float phi = 2*M_PI*r1;
+  float x = cos(phi)*sqrt(1 - z*z);
+  float y = sin(phi)*sqrt(1 - z*z);
+  return onb(direction).local(x, y, z);
+}
+
+// the quadratic for all lanes at once, records only for the hit ones
+int sphere::hit_packet(const ray_packet& p, int active, float t_min,
+                       float* t_max, hit_record* rec) const {
+  float t[packet_size];
+  int mask = 0;
+  for (int k = 0; k < packet_size; k++) {
+    float ocx = p.o[0][k] - center.e[0];
+    float ocy = p.o[1][k] - center.e[1];
+    float ocz = p.o[2][k] - center.e[2];
+    float a = p.d[0][k]*p.d[0][k] + p.d[1][k]*p.d[1][k] + p.d[2][k]*p.d[2][k];
+    float b = ocx*p.d[0][k] + ocy*p.d[1][k] + ocz*p.d[2][k];
+    float c = ocx*ocx + ocy*ocy + ocz*ocz - radius*radius;
+    float discriminant = b*b - a*c;
+    // NaN for a negative discriminant, the mask drops those lanes
+    float t0 = (-b - sqrt(discriminant)) / a;
+    float t1 = (-b + sqrt(discriminant)) / a;
+    bool hit0 = t0 < t_max[k] && t0 > t_min;
+    bool hit1 = t1 < t_max[k] && t1 > t_min;
+    t[k] = hit0 ? t0 : t1;
+    mask |= (discriminant > 0 && (hit0 || hit1)) << k;
+  }
+  mask &= active;
+
+  for (int k = 0; k < packet_size; k++) {
+    if (!(mask & (1 << k))) continue;
+    rec[k].t = t_max[k] = t[k];
+    rec[k].p = p.r[k].point_at_parameter(t[k]);
+    get_uv((rec[k].p-center)/radius, rec[k].u, rec[k].v);
+    rec[k].normal = (rec[k].p - center) / radius;
+    rec[k].uv_scale = sphere_uv_scale(rec[k].normal, radius);
+    rec[k].mat_ptr = mat_ptr;
+  }
+  return mask;
+}
+
 class moving_sphere: public hitable {
  public:
   moving_sphere() {}
@@ -118,6 +193,7 @@ bool moving_sphere::hit(const ray &r, float t_min, float t_max, hit_record& rec)
       rec.p = r.point_at_parameter(rec.t);
       get_uv((rec.p-center(r.time()))/radius, rec.u, rec.v);
       rec.normal = (rec.p - center(r.time())) / radius;
+      rec.uv_scale = sphere_uv_scale(rec.normal, radius);
       rec.mat_ptr = mat_ptr;
       return true;
     }
@@ -128,6 +204,7 @@ bool moving_sphere::hit(const ray &r, float t_min, float t_max, hit_record& rec)
       rec.p = r.point_at_parameter(rec.t);
       get_uv((rec.p-center(r.time()))/radius, rec.u, rec.v);
       rec.normal = (rec.p - center(r.time())) / radius;
+      rec.uv_scale = sphere_uv_scale(rec.normal, radius);
       rec.mat_ptr = mat_ptr;
       return true;
     }
@@ -0,0 +1,229 @@
+#ifndef __SPHERESETH__
+#define __SPHERESETH__
+/*
+class sphere_set.
+many static spheres as one hitable. the spheres are kept in chunks of
+8 in SoA layout (centers, radii, material ids), one AVX sequence tests
+a ray against a whole chunk. a flat bvh over the spheres, leaves of up
+to 8, has one chunk as the payload of every leaf. without -mavx the
+chunk test is a plain loop over the 8 lanes.
+ */
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+#include "hitable.h"
+#include "linear_bvh.h"
+#include "sphere.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+const int sphere_chunk_size = 8;
+
+struct alignas(32) sphere_chunk {
+  float cx[sphere_chunk_size];
+  float cy[sphere_chunk_size];
+  float cz[sphere_chunk_size];
+  float radius[sphere_chunk_size];
+  // index into sphere_set::materials
+  int material[sphere_chunk_size];
+  // lanes [count, 8) are empty
+  int count;
+};
+
+// the lane of the closest hit in (t_min, t_max), -1 for none
+inline int chunk_hit(const sphere_chunk& c, const ray& r, float t_min, float t_max, float& t_hit) {
+  float a = dot(r.direction(), r.direction());
+  float inv_a = 1 / a;
+#if defined(__AVX__)
+  __m256 ox = _mm256_set1_ps(r.A[0]), oy = _mm256_set1_ps(r.A[1]), oz = _mm256_set1_ps(r.A[2]);
+  __m256 dx = _mm256_set1_ps(r.B[0]), dy = _mm256_set1_ps(r.B[1]), dz = _mm256_set1_ps(r.B[2]);
+  // center minus origin, so b comes out with the sign the roots want
+  __m256 ocx = _mm256_sub_ps(_mm256_load_ps(c.cx), ox);
+  __m256 ocy = _mm256_sub_ps(_mm256_load_ps(c.cy), oy);
+  __m256 ocz = _mm256_sub_ps(_mm256_load_ps(c.cz), oz);
+  __m256 rad = _mm256_load_ps(c.radius);
+  __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)),
+                           _mm256_mul_ps(ocz, dz));
+  __m256 cc = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)),
+                                          _mm256_mul_ps(ocz, ocz)),
+                            _mm256_mul_ps(rad, rad));
+  __m256 disc = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(_mm256_set1_ps(a), cc));
+  __m256 valid = _mm256_cmp_ps(disc, _mm256_setzero_ps(), _CMP_GT_OQ);
+  __m256 root = _mm256_sqrt_ps(_mm256_max_ps(disc, _mm256_setzero_ps()));
+  __m256 ia = _mm256_set1_ps(inv_a);
+  __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(b, root), ia);
+  __m256 t1 = _mm256_mul_ps(_mm256_add_ps(b, root), ia);
+  __m256 tmin = _mm256_set1_ps(t_min);
+  __m256 tmax = _mm256_set1_ps(t_max);
+  // the near root, or the far one from inside
+  __m256 t = _mm256_blendv_ps(t1, t0, _mm256_cmp_ps(t0, tmin, _CMP_GT_OQ));
+  valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, tmin, _CMP_GT_OQ));
+  valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, tmax, _CMP_LT_OQ));
+  int mask = _mm256_movemask_ps(valid) & ((1 << c.count) - 1);
+  if (!mask) return -1;
+  float ts[sphere_chunk_size];
+  _mm256_storeu_ps(ts, t);
+#else
+  float ts[sphere_chunk_size];
+  int mask = 0;
+  for (int k = 0; k < sphere_chunk_size; k++) {
+    float ocx = c.cx[k] - r.A[0], ocy = c.cy[k] - r.A[1], ocz = c.cz[k] - r.A[2];
+    float b = ocx*r.B[0] + ocy*r.B[1] + ocz*r.B[2];
+    float cc = ocx*ocx + ocy*ocy + ocz*ocz - c.radius[k]*c.radius[k];
+    float disc = b*b - a*cc;
+    float root = sqrt(ffmax(disc, 0));
+    float t0 = (b - root) * inv_a;
+    float t1 = (b + root) * inv_a;
+    ts[k] = t0 > t_min ? t0 : t1;
+    mask |= (disc > 0 && ts[k] > t_min && ts[k] < t_max) << k;
+  }
+  mask &= (1 << c.count) - 1;
+  if (!mask) return -1;
+#endif
+  int best = -1;
+  for (; mask; mask &= mask - 1) {
+    int k = __builtin_ctz(mask);
+    if (best < 0 || ts[k] < ts[best]) best = k;
+  }
+  t_hit = ts[best];
+  return best;
+}
+
+class sphere_set : public hitable {
+ public:
+  sphere_set() {}
+  // material_id[i] indexes materials. without a bvh every ray tests
+  // every chunk, which is fine for a few hundred spheres.
+  sphere_set(const std::vector<vec3>& centers, const std::vector<float>& radii,
+             const std::vector<int>& material_id, const std::vector<material*>& materials,
+             bool use_bvh = true);
+  virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+  virtual bool bounding_box(float t0, float t1, aabb& box) const {
+    if (chunks.empty()) return false;
+    box = bbox;
+    return true;
+  }
+  virtual int hit_packet(const ray_packet& p, int active, float t_min,
+                         float* t_max, hit_record* rec) const;
+
+  std::vector<sphere_chunk> chunks;
+  std::vector<material*> materials;
+  // leaves hold one chunk each, their offset is the chunk index
+  flat_bvh tree;
+  aabb bbox;
+
+ private:
+  void add_chunk(const std::vector<vec3>& centers, const std::vector<float>& radii,
+                 const std::vector<int>& material_id, const int* index, int n);
+  void fill(const sphere_chunk& c, int k, const ray& r, float t, hit_record& rec) const;
+};
+
+sphere_set::sphere_set(const std::vector<vec3>& centers, const std::vector<float>& radii,
+                       const std::vector<int>& material_id, const std::vector<material*>& m,
+                       bool use_bvh) : materials(m) {
+  int n = static_cast<int>(centers.size());
+  if (n == 0) return;
+  std::vector<bvh_primitive> prims(n);
+  for (int i = 0; i < n; i++) {
+    vec3 extent(radii[i], radii[i], radii[i]);
+    prims[i].box = aabb(centers[i] - extent, centers[i] + extent);
+    prims[i].centroid = centers[i];
+    prims[i].index = i;
+  }
+  bbox = primitive_bounds(prims.data(), n);
+
+  if (!use_bvh) {
+    std::vector<int> index(n);
+    for (int i = 0; i < n; i++) index[i] = i;
+    for (int i = 0; i < n; i += sphere_chunk_size)
+      add_chunk(centers, radii, material_id, index.data() + i, std::min(sphere_chunk_size, n - i));
+    return;
+  }
+  tree.build(prims, sphere_chunk_size);
+  for (linear_bvh_node& node : tree.nodes) {
+    if (node.nprims == 0) continue;
+    int chunk = static_cast<int>(chunks.size());
+    add_chunk(centers, radii, material_id, tree.order.data() + node.offset, node.nprims);
+    node.offset = chunk;
+    node.nprims = 1;
+  }
+}
+
+void sphere_set::add_chunk(const std::vector<vec3>& centers, const std::vector<float>& radii,
+                           const std::vector<int>& material_id, const int* index, int n) {
+  sphere_chunk c;
+  c.count = n;
+  for (int k = 0; k < sphere_chunk_size; k++) {
+    // empty lanes repeat the first sphere, the count masks them
+    int i = index[k < n ? k : 0];
+    c.cx[k] = centers[i][0];
+    c.cy[k] = centers[i][1];
+    c.cz[k] = centers[i][2];
+    c.radius[k] = radii[i];
+    c.material[k] = material_id[i];
+  }
+  chunks.push_back(c);
+}
+
+void sphere_set::fill(const sphere_chunk& c, int k, const ray& r, float t, hit_record& rec) const {
+  vec3 center(c.cx[k], c.cy[k], c.cz[k]);
+  rec.t = t;
+  rec.p = r.point_at_parameter(t);
+  rec.normal = (rec.p - center) / c.radius[k];
+  sphere::get_uv(rec.normal, rec.u, rec.v);
+  rec.uv_scale = sphere_uv_scale(rec.normal, c.radius[k]);
+  rec.mat_ptr = materials[c.material[k]];
+}
+
+bool sphere_set::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+  if (tree.nodes.empty()) {
+    bool hit_anything = false;
+    for (const sphere_chunk& c : chunks) {
+      float t;
+      int k = chunk_hit(c, r, t_min, t_max, t);
+      if (k < 0) continue;
+      fill(c, k, r, t, rec);
+      t_max = t;
+      hit_anything = true;
+    }
+    return hit_anything;
+  }
+  return tree.traverse(r, t_min, t_max, [&](int chunk, float tmin, float& tmax) {
+    float t;
+    int k = chunk_hit(chunks[chunk], r, tmin, tmax, t);
+    if (k < 0) return false;
+    fill(chunks[chunk], k, r, t, rec);
+    tmax = t;
+    return true;
+  });
+}
+
+// a chunk is 8 spheres wide already, the lanes of the packet take turns
+int sphere_set::hit_packet(const ray_packet& p, int active, float t_min,
+                           float* t_max, hit_record* rec) const {
+  auto intersect = [&](int chunk, int m) {
+    int mask = 0;
+    for (; m; m &= m - 1) {
+      int lane = __builtin_ctz(m);
+      float t;
+      int k = chunk_hit(chunks[chunk], p.r[lane], t_min, t_max[lane], t);
+      if (k < 0) continue;
+      fill(chunks[chunk], k, p.r[lane], t, rec[lane]);
+      t_max[lane] = t;
+      mask |= 1 << lane;
+    }
+    return mask;
+  };
+  if (!tree.nodes.empty())
+    return tree.traverse_packet(p, active, t_min, t_max, intersect);
+  int mask = 0;
+  for (int c = 0; c < static_cast<int>(chunks.size()); c++)
+    mask |= intersect(c, active);
+  return mask;
+}
+
+#endif
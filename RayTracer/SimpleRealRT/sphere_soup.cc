@@ -0,0 +1,88 @@
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "arena.h"
+#include "sphere_set.h"
+#include "sphere.h"
+#include "camera.h"
+#include "render.h"
+#include "integrator.h"
+#include "texture.h"
+#include "material.h"
+#include "hitable_list.h"
+
+// the final scene of the first book, the small spheres in one
+// sphere_set. grid is the number of spheres along each side.
+hitable* random_scene(arena& scene, int grid) {
+  std::vector<vec3> centers;
+  std::vector<float> radii;
+  std::vector<int> material_id;
+  std::vector<material*> materials;
+  // the dielectric is shared, the other materials differ per sphere
+  materials.push_back(scene.make<dielectric>(1.5));
+
+  uint64_t state = 0;
+  auto random = [&]() {
+    return static_cast<float>(mix_bits(++state) >> 40) * (1.0f / 16777216.0f);
+  };
+  float cell = 22.0f / grid;
+  for (int a = 0; a < grid; a++) {
+    for (int b = 0; b < grid; b++) {
+      float choose_mat = random();
+      vec3 center(-11 + cell*(a + 0.9*random()), 0.2*cell, -11 + cell*(b + 0.9*random()));
+      if ((center-vec3(-4.0, 0.2, 0.0)).length() > 0.9 &&
+          (center-vec3(0.0, 0.2, 0.0)).length() > 0.9 &&
+          (center-vec3(4.0, 0.2, 0.0)).length() > 0.9) {
+        centers.push_back(center);
+        radii.push_back(0.2*cell);
+        if (choose_mat < 0.8) {
+          material_id.push_back(materials.size());
+          materials.push_back(scene.make<lambertian>(scene.make<constant_texture>(
+              vec3(random()*random(), random()*random(), random()*random()))));
+        } else if (choose_mat < 0.95) {
+          material_id.push_back(materials.size());
+          materials.push_back(scene.make<metal>(
+              vec3(0.5*(1+random()), 0.5*(1+random()), 0.5*(1+random())), 0.5*random()));
+        } else {
+          material_id.push_back(0);
+        }
+      }
+    }
+  }
+
+  hitable** list = scene.make_array<hitable*>(5);
+  list[0] = scene.make<sphere>(vec3(0,-1000,0), 1000,
+                               scene.make<lambertian>(scene.make<constant_texture>(vec3(0.5, 0.5, 0.5))));
+  list[1] = scene.make<sphere>(vec3(0,1,0), 1.0, scene.make<dielectric>(1.5));
+  list[2] = scene.make<sphere>(vec3(4,1,0), 1.0,
+                               scene.make<lambertian>(scene.make<constant_texture>(vec3(0.3, 0.5, 0.2))));
+  list[3] = scene.make<sphere>(vec3(-4,1,0), 1.0, scene.make<metal>(vec3(0.7,0.6,0.5), 0.3));
+  list[4] = scene.make<sphere_set>(centers, radii, material_id, materials);
+  return scene.make<hitable_list>(list, 5);
+}
+
+int main(int argc, char** argv) {
+  int nx = 1200;
+  int ny = 800;
+  int ns = 10;
+  // 22 gives the ~500 spheres of the book, 1000 about a million
+  int grid = argc > 1 ? atoi(argv[1]) : 22;
+
+  // everything the scene is built of, freed at once
+  arena scene;
+  hitable* world = random_scene(scene, grid);
+
+  // camera info.
+  vec3 lookfrom(13, 2, 3);
+  vec3 lookat(0, 0, 0);
+  float dist_to_focus = 10.0;
+  float aspect = float(nx) / float(ny);
+  float vfov = 20;
+  float aperture = 0.1;
+  camera cam(lookfrom, lookat, vec3(0,1,0), vfov,
+             aspect, aperture, dist_to_focus, 0.0, 1.0);
+
+  framebuffer fb(nx, ny);
+  render_packets(fb, cam, world, ns, sky_background);
+  write_ppm(stdout, fb);
+}
@@ -1,18 +1,39 @@
 #ifndef __TEXTUREH__
 #define __TEXTUREH__
 
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
 #include "noise.h"
 
+// the textures texture_value() evaluates without a virtual call,
+// any other texture is open and goes through value()
+enum class texture_kind : unsigned char {
+  open, constant, checker, image, value_noise, perlin_noise
+};
+
 class texture {
  public:
+  texture(texture_kind k = texture_kind::open) : kind(k) {}
   virtual vec3 value(float u, float v, const vec3& p) const = 0;
+  // the value over a footprint in uv, for open textures that filter
+  virtual vec3 filtered_value(float u, float v, const vec3& p, float footprint) const {
+    return value(u, v, p);
+  }
+  texture_kind kind;
 };
 
+// footprint is the width in uv around (u, v) the value stands for,
+// filtered textures pick their detail by it
+inline vec3 texture_value(const texture* t, float u, float v, const vec3& p,
+                          float footprint = 0);
+
 // treat color as texture
-class constant_texture : public texture {
+class constant_texture final : public texture {
  public:
-  constant_texture() {}
-  constant_texture(vec3 c) : color(c) {}
+  constant_texture() : texture(texture_kind::constant) {}
+  constant_texture(vec3 c) : texture(texture_kind::constant), color(c) {}
   virtual vec3 value(float u, float v, const vec3& p) const {
     return color;
   }
@@ -20,16 +41,20 @@ class constant_texture : public texture {
 };
 
 // checkerboard texture
-class checker_texture : public texture {
+class checker_texture final : public texture {
  public:
-  checker_texture() {}
-  checker_texture(texture* text0, texture* text1): even(text0), odd(text1) {}
+  checker_texture() : texture(texture_kind::checker) {}
+  checker_texture(texture* text0, texture* text1)
+    : texture(texture_kind::checker), odd(text1), even(text0) {}
   virtual vec3 value(float u, float v, const vec3& p) const {
+    return value(u, v, p, 0);
+  }
+  vec3 value(float u, float v, const vec3& p, float footprint) const {
     float sines = sin(10*p.x())*sin(10*p.y())*sin(10*p.z());
     if (sines < 0.) {
-      return odd->value(u, v, p);
+      return texture_value(odd, u, v, p, footprint);
     } else {
-      return even->value(u, v, p);
+      return texture_value(even, u, v, p, footprint);
     }
   }
 
@@ -38,39 +63,127 @@ class checker_texture : public texture {
   texture* even;
 };
 
-class image_texture : public texture {
+// of the rgb texels a b (top) and c d (bottom)
+inline vec3 bilerp(const float* a, const float* b, const float* c, const float* d,
+                   float fx, float fy) {
+  vec3 r;
+  for (int k = 0; k < 3; k++) {
+    float top = a[k] + fx*(b[k] - a[k]);
+    float bottom = c[k] + fx*(d[k] - c[k]);
+    r[k] = top + fy*(bottom - top);
+  }
+  return r;
+}
+
+// a mip level in tiles of 4x4 texels, the four texels of a bilinear
+// lookup are mostly in one 192 byte tile instead of two image rows
+struct mip_level {
+  mip_level() : nx(0), ny(0), tiles_x(0) {}
+  mip_level(int x, int y)
+    : nx(x), ny(y), tiles_x((x+3) / 4), texels(3 * 16 * tiles_x * ((y+3) / 4)) {}
+
+  float* texel(int i, int j) {
+    return &texels[3 * (((j >> 2)*tiles_x + (i >> 2))*16 + (j & 3)*4 + (i & 3))];
+  }
+  const float* texel(int i, int j) const {
+    return &texels[3 * (((j >> 2)*tiles_x + (i >> 2))*16 + (j & 3)*4 + (i & 3))];
+  }
+  // texel centers at half integers, clamped at the border
+  vec3 bilinear(float x, float y) const;
+
+  int nx, ny, tiles_x;
+  std::vector<float> texels;
+};
+
+vec3 mip_level::bilinear(float x, float y) const {
+  x -= 0.5f;
+  y -= 0.5f;
+  float fx = floorf(x), fy = floorf(y);
+  int i0 = static_cast<int>(fx), j0 = static_cast<int>(fy);
+  fx = x - fx;
+  fy = y - fy;
+  int i1 = std::min(std::max(i0 + 1, 0), nx-1), j1 = std::min(std::max(j0 + 1, 0), ny-1);
+  i0 = std::min(std::max(i0, 0), nx-1);
+  j0 = std::min(std::max(j0, 0), ny-1);
+  return bilerp(texel(i0, j0), texel(i1, j0), texel(i0, j1), texel(i1, j1), fx, fy);
+}
+
+// the 8 bit image is converted once to linear float (gamma 2, as the
+// output is written) with a mip chain of 2x2 box filtered levels. the
+// image data is not kept, the caller can free it.
+class image_texture final : public texture {
  public:
-  image_texture() {}
-  image_texture(unsigned char* image, int A, int B, int C)
-    : data(image), nx(A), ny(B), nn(C) {}
-  virtual vec3 value(float u, float v, const vec3& p) const;
+  image_texture() : texture(texture_kind::image), nx(0), ny(0), nn(0) {}
+  image_texture(const unsigned char* image, int A, int B, int C);
+  virtual vec3 value(float u, float v, const vec3& p) const {
+    return lookup(u, v, 0);
+  }
+  // footprint is the width in uv the lookup covers, 0 or less than a
+  // texel is bilinear in the full image, more is trilinear between the
+  // two levels around it
+  vec3 lookup(float u, float v, float footprint) const;
 
-  // image data as a big array
-  unsigned char* data;
   int nx, ny, nn;
+  std::vector<mip_level> levels;
 };
 
-vec3 image_texture::value(float u, float v, const vec3& p) const {
-  int i = u*nx;
-  // note that the image coordinate and the global coordinate are different
-  // here we minus 0.001 from y to locate at the last row
-  int j = (1-v)*ny - 0.001;
-  if (i < 0) i = 0;
-  if (j < 0) j = 0;
-  if (i > nx-1) i = nx-1;
-  if (j > ny-1) j = ny-1;
-
-  // convert 1-d array to the corresponding 2-d
-  float r = int(data[nn*nx*j+0 + nn*i]) / 255.0;
-  float g = int(data[nn*nx*j+1 + nn*i]) / 255.0;
-  float b = int(data[nn*nx*j+2 + nn*i]) / 255.0;
-  return vec3(r,g,b);
+image_texture::image_texture(const unsigned char* image, int A, int B, int C)
+  : texture(texture_kind::image), nx(A), ny(B), nn(C) {
+  if (!image || nx <= 0 || ny <= 0 || nn <= 0) {
+    std::cerr << "image_texture: no image data\n";
+    nx = ny = nn = 1;
+    levels.emplace_back(1, 1);
+    return;
+  }
+  levels.emplace_back(nx, ny);
+  mip_level& base = levels[0];
+  // gray images, with or without alpha, have one color channel
+  int channels = nn < 3 ? 1 : 3;
+  for (int j = 0; j < ny; j++) {
+    for (int i = 0; i < nx; i++) {
+      float* t = base.texel(i, j);
+      for (int k = 0; k < 3; k++) {
+        float c = image[nn*(nx*j + i) + (channels == 1 ? 0 : k)] / 255.0f;
+        t[k] = c*c;
+      }
+    }
+  }
+  while (levels.back().nx > 1 || levels.back().ny > 1) {
+    const mip_level& fine = levels.back();
+    mip_level coarse(std::max(fine.nx / 2, 1), std::max(fine.ny / 2, 1));
+    for (int j = 0; j < coarse.ny; j++) {
+      for (int i = 0; i < coarse.nx; i++) {
+        int i0 = std::min(2*i, fine.nx-1), i1 = std::min(2*i + 1, fine.nx-1);
+        int j0 = std::min(2*j, fine.ny-1), j1 = std::min(2*j + 1, fine.ny-1);
+        float* t = coarse.texel(i, j);
+        for (int k = 0; k < 3; k++)
+          t[k] = 0.25f * (fine.texel(i0, j0)[k] + fine.texel(i1, j0)[k] +
+                          fine.texel(i0, j1)[k] + fine.texel(i1, j1)[k]);
+      }
+    }
+    levels.push_back(std::move(coarse));
+  }
+}
+
+vec3 image_texture::lookup(float u, float v, float footprint) const {
+  // the image rows go down, v goes up
+  float y = 1 - v;
+  // the level whose texels are as wide as the footprint
+  float lod = footprint > 0 ? log2f(footprint * sqrtf(float(nx) * float(ny))) : 0;
+  if (!(lod > 0)) return levels[0].bilinear(u * levels[0].nx, y * levels[0].ny);
+  int top = static_cast<int>(levels.size()) - 1;
+  if (lod >= top) return levels[top].bilinear(u * levels[top].nx, y * levels[top].ny);
+  int l = static_cast<int>(lod);
+  float f = lod - l;
+  const mip_level& a = levels[l];
+  const mip_level& b = levels[l+1];
+  return (1 - f) * a.bilinear(u * a.nx, y * a.ny) + f * b.bilinear(u * b.nx, y * b.ny);
 }
 
-class value_noise_texture : public texture {
+class value_noise_texture final : public texture {
  public:
-  value_noise_texture() {}
-  value_noise_texture(float sc) : scale(sc) {}
+  value_noise_texture() : texture(texture_kind::value_noise) {}
+  value_noise_texture(float sc) : texture(texture_kind::value_noise), scale(sc) {}
   virtual vec3 value(float u, float v, const vec3& p) const {
     return vec3(1,1,1) * noise.noise(scale*p);
   }
@@ -80,10 +193,11 @@ class value_noise_texture : public texture {
   float scale;
 };
 
-class perlin_noise_texture : public texture {
+class perlin_noise_texture final : public texture {
  public:
-  perlin_noise_texture() {}
-  perlin_noise_texture(float sc, int type=0) : scale(sc), value_type(type) {}
+  perlin_noise_texture() : texture(texture_kind::perlin_noise) {}
+  perlin_noise_texture(float sc, int type=0)
+    : texture(texture_kind::perlin_noise), scale(sc), value_type(type) {}
   virtual vec3 value(float u, float v, const vec3& p) const {
     if (value_type == 0) {
       return vec3(1,1,1) * noise.noise(scale*p);
@@ -99,4 +213,24 @@ class perlin_noise_texture : public texture {
   int value_type;
 };
 
+// a switch over the closed set, the casts to final classes make
+// the value() calls direct, so they can be inlined
+inline vec3 texture_value(const texture* t, float u, float v, const vec3& p,
+                          float footprint) {
+  switch (t->kind) {
+    case texture_kind::constant:
+      return static_cast<const constant_texture*>(t)->color;
+    case texture_kind::checker:
+      return static_cast<const checker_texture*>(t)->value(u, v, p, footprint);
+    case texture_kind::image:
+      return static_cast<const image_texture*>(t)->lookup(u, v, footprint);
+    case texture_kind::value_noise:
+      return static_cast<const value_noise_texture*>(t)->value(u, v, p);
+    case texture_kind::perlin_noise:
+      return static_cast<const perlin_noise_texture*>(t)->value(u, v, p);
+    default:
+      return t->filtered_value(u, v, p, footprint);
+  }
+}
+
 #endif
@@ -0,0 +1,370 @@
+#ifndef __TEXTURECACHEH__
+#define __TEXTURECACHEH__
+/*
+class texture_cache, class cached_texture.
+large image textures are converted once to a tiled file: the linear
+float mip chain of image_texture, every level cut into 32x32 texel
+tiles of 12 KB. a texture_cache reads tiles from those files when a
+lookup needs them and keeps at most max_bytes of them, dropping the
+least recently used. the tiles are spread over shards by their key,
+every shard has its own lock and lru list, so the render threads
+rarely wait on each other. a tile handed out stays valid while the
+lookup uses it, even if the cache drops it meanwhile.
+
+  texture_cache cache(64 << 20);
+  if (update_tiled_texture("earth.jpg", "earth.jpg.tiles"))
+    t = scene.make<cached_texture>(&cache, cache.open("earth.jpg.tiles"));
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "sampler.h"
+#include "texture.h"
+#include "stb_image.h"
+
+const int texture_tile_size = 32;
+const char tiled_texture_magic[8] = { 'G', 'T', 'T', 'I', 'L', 'E', 'S', '1' };
+
+struct tiled_texture_header {
+  char magic[8];
+  int32_t nx, ny;
+  int32_t levels;
+  int32_t tile_size;
+};
+
+// followed by the tiles of the level, row by row, from offset
+struct tiled_texture_level {
+  int32_t nx, ny;
+  int32_t tiles_x, tiles_y;
+  int64_t offset;
+};
+
+// the texels of a tile row by row, those past the image edge are 0
+struct texture_tile {
+  float texels[3 * texture_tile_size * texture_tile_size];
+};
+
+// an open tiled file
+struct tiled_texture {
+  int fd;
+  int id;
+  std::string path;
+  tiled_texture_header header;
+  std::vector<tiled_texture_level> levels;
+};
+
+struct texture_cache_stats {
+  uint64_t hits, misses, evictions;
+  // what the cache holds now
+  uint64_t tiles, bytes;
+};
+
+// decode image_path and write its tiled form to tiled_path
+bool write_tiled_texture(const char* image_path, const char* tiled_path) {
+  int nx, ny, nn;
+  unsigned char* data = stbi_load(image_path, &nx, &ny, &nn, 0);
+  if (!data) {
+    std::cerr << "cannot load image " << image_path << "\n";
+    return false;
+  }
+  // the same conversion and mip chain as in memory
+  image_texture image(data, nx, ny, nn);
+  stbi_image_free(data);
+
+  tiled_texture_header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, tiled_texture_magic, sizeof(h.magic));
+  h.nx = nx;
+  h.ny = ny;
+  h.levels = image.levels.size();
+  h.tile_size = texture_tile_size;
+  std::vector<tiled_texture_level> levels(h.levels);
+  int64_t offset = sizeof(h) + h.levels * sizeof(tiled_texture_level);
+  for (int l = 0; l < h.levels; l++) {
+    tiled_texture_level& tl = levels[l];
+    tl.nx = image.levels[l].nx;
+    tl.ny = image.levels[l].ny;
+    tl.tiles_x = (tl.nx + texture_tile_size - 1) / texture_tile_size;
+    tl.tiles_y = (tl.ny + texture_tile_size - 1) / texture_tile_size;
+    tl.offset = offset;
+    offset += static_cast<int64_t>(tl.tiles_x) * tl.tiles_y * sizeof(texture_tile);
+  }
+
+  // written next to the target and renamed over it, so a failed or
+  // killed conversion never leaves a half written file that is newer
+  // than the image
+  std::string tmp = std::string(tiled_path) + ".tmp";
+  FILE* f = fopen(tmp.c_str(), "wb");
+  if (!f) {
+    std::cerr << "cannot write " << tmp << "\n";
+    return false;
+  }
+  fwrite(&h, sizeof(h), 1, f);
+  fwrite(levels.data(), sizeof(tiled_texture_level), levels.size(), f);
+  texture_tile tile;
+  for (int l = 0; l < h.levels; l++) {
+    const mip_level& m = image.levels[l];
+    for (int ty = 0; ty < levels[l].tiles_y; ty++) {
+      for (int tx = 0; tx < levels[l].tiles_x; tx++) {
+        memset(&tile, 0, sizeof(tile));
+        for (int y = 0; y < texture_tile_size; y++) {
+          int j = ty*texture_tile_size + y;
+          for (int x = 0; x < texture_tile_size && j < m.ny; x++) {
+            int i = tx*texture_tile_size + x;
+            if (i >= m.nx) break;
+            memcpy(&tile.texels[3 * (y*texture_tile_size + x)], m.texel(i, j), 3 * sizeof(float));
+          }
+        }
+        fwrite(&tile, sizeof(tile), 1, f);
+      }
+    }
+  }
+  bool ok = !ferror(f);
+  ok = (fclose(f) == 0) && ok;
+  if (!ok || rename(tmp.c_str(), tiled_path) != 0) {
+    std::cerr << "cannot write " << tiled_path << "\n";
+    remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+// converts the image unless the tiled file is at least as new
+bool update_tiled_texture(const char* image_path, const char* tiled_path) {
+  struct stat image_stat, tiled_stat;
+  if (stat(image_path, &image_stat) != 0) {
+    std::cerr << "cannot find image " << image_path << "\n";
+    return false;
+  }
+  if (stat(tiled_path, &tiled_stat) == 0 && tiled_stat.st_mtime >= image_stat.st_mtime)
+    return true;
+  return write_tiled_texture(image_path, tiled_path);
+}
+
+class texture_cache {
+ public:
+  explicit texture_cache(size_t max_bytes);
+  ~texture_cache();
+  texture_cache(const texture_cache&) = delete;
+  texture_cache& operator=(const texture_cache&) = delete;
+
+  // nullptr when the file is missing or not a tiled texture
+  const tiled_texture* open(const char* path);
+  // the tile (tx, ty) of a level, read from the file on a miss.
+  // nullptr when the read fails.
+  std::shared_ptr<const texture_tile> tile(const tiled_texture& t, int level, int tx, int ty);
+  texture_cache_stats stats() const;
+
+ private:
+  static const int shard_count = 16;
+  typedef std::pair<uint64_t, std::shared_ptr<const texture_tile>> entry;
+  struct shard {
+    std::mutex lock;
+    // the most recently used first
+    std::list<entry> lru;
+    std::unordered_map<uint64_t, std::list<entry>::iterator> index;
+  };
+
+  std::shared_ptr<const texture_tile> read(const tiled_texture& t, int level, int tx, int ty);
+
+  shard shards[shard_count];
+  size_t shard_tiles;
+  std::mutex files_lock;
+  std::vector<std::unique_ptr<tiled_texture>> files;
+  std::atomic<uint64_t> hits, misses, evictions;
+};
+
+// the budget is split evenly over the shards, at least one tile each
+texture_cache::texture_cache(size_t max_bytes)
+  : shard_tiles(std::max<size_t>(max_bytes / sizeof(texture_tile) / shard_count, 1)),
+    hits(0), misses(0), evictions(0) {}
+
+texture_cache::~texture_cache() {
+  for (auto& f : files) close(f->fd);
+}
+
+const tiled_texture* texture_cache::open(const char* path) {
+  int fd = ::open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    if (fd >= 0) close(fd);
+    std::cerr << "cannot open " << path << "\n";
+    return nullptr;
+  }
+  std::unique_ptr<tiled_texture> t(new tiled_texture);
+  t->fd = fd;
+  t->path = path;
+  tiled_texture_header& h = t->header;
+  bool ok = pread(fd, &h, sizeof(h), 0) == static_cast<ssize_t>(sizeof(h)) &&
+            memcmp(h.magic, tiled_texture_magic, sizeof(h.magic)) == 0 &&
+            h.tile_size == texture_tile_size && h.levels > 0 && h.levels < 32;
+  if (ok) {
+    t->levels.resize(h.levels);
+    size_t bytes = h.levels * sizeof(tiled_texture_level);
+    ok = pread(fd, t->levels.data(), bytes, sizeof(h)) == static_cast<ssize_t>(bytes) &&
+         t->levels[0].nx == h.nx && t->levels[0].ny == h.ny;
+  }
+  // every level's tiles inside the file
+  for (int l = 0; ok && l < h.levels; l++) {
+    const tiled_texture_level& tl = t->levels[l];
+    int64_t tiles = static_cast<int64_t>(tl.tiles_x) * tl.tiles_y;
+    ok = tl.nx > 0 && tl.ny > 0 && tl.tiles_x > 0 && tl.tiles_y > 0 &&
+         tl.tiles_x == (tl.nx + texture_tile_size - 1) / texture_tile_size &&
+         tl.tiles_y == (tl.ny + texture_tile_size - 1) / texture_tile_size &&
+         tl.offset > 0 && tl.offset + tiles * static_cast<int64_t>(sizeof(texture_tile)) <= st.st_size;
+  }
+  if (!ok) {
+    close(fd);
+    std::cerr << path << " is not a tiled texture\n";
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> guard(files_lock);
+  t->id = files.size();
+  files.push_back(std::move(t));
+  return files.back().get();
+}
+
+std::shared_ptr<const texture_tile> texture_cache::read(const tiled_texture& t, int level,
+                                                        int tx, int ty) {
+  const tiled_texture_level& tl = t.levels[level];
+  off_t at = tl.offset + (static_cast<int64_t>(ty) * tl.tiles_x + tx) * sizeof(texture_tile);
+  std::shared_ptr<texture_tile> tile(new texture_tile);
+  if (pread(t.fd, tile->texels, sizeof(texture_tile), at) != static_cast<ssize_t>(sizeof(texture_tile))) {
+    std::cerr << "cannot read a tile of " << t.path << "\n";
+    return nullptr;
+  }
+  return tile;
+}
+
+std::shared_ptr<const texture_tile> texture_cache::tile(const tiled_texture& t, int level,
+                                                        int tx, int ty) {
+  const tiled_texture_level& tl = t.levels[level];
+  // file, level and tile in 16, 8 and 40 bits
+  uint64_t key = (static_cast<uint64_t>(t.id) << 48) | (static_cast<uint64_t>(level) << 40) |
+                 (static_cast<uint64_t>(ty) * tl.tiles_x + tx);
+  shard& s = shards[mix_bits(key) % shard_count];
+  std::lock_guard<std::mutex> guard(s.lock);
+  auto found = s.index.find(key);
+  if (found != s.index.end()) {
+    hits.fetch_add(1, std::memory_order_relaxed);
+    s.lru.splice(s.lru.begin(), s.lru, found->second);
+    return found->second->second;
+  }
+  misses.fetch_add(1, std::memory_order_relaxed);
+  // read under the lock, two threads missing the same tile read it once
+  std::shared_ptr<const texture_tile> tile = read(t, level, tx, ty);
+  if (!tile) return nullptr;
+  if (s.lru.size() >= shard_tiles) {
+    s.index.erase(s.lru.back().first);
+    s.lru.pop_back();
+    evictions.fetch_add(1, std::memory_order_relaxed);
+  }
+  s.lru.emplace_front(key, tile);
+  s.index[key] = s.lru.begin();
+  return tile;
+}
+
+texture_cache_stats texture_cache::stats() const {
+  texture_cache_stats st;
+  st.hits = hits.load();
+  st.misses = misses.load();
+  st.evictions = evictions.load();
+  st.tiles = 0;
+  for (int k = 0; k < shard_count; k++) {
+    std::lock_guard<std::mutex> guard(const_cast<shard&>(shards[k]).lock);
+    st.tiles += shards[k].lru.size();
+  }
+  st.bytes = st.tiles * sizeof(texture_tile);
+  return st;
+}
+
+std::ostream& operator<<(std::ostream& os, const texture_cache_stats& st) {
+  uint64_t lookups = st.hits + st.misses;
+  return os << "texture cache: " << lookups << " tile lookups, " << st.hits << " hits ("
+            << (lookups ? 100.0 * st.hits / lookups : 0) << "%), " << st.misses << " misses, "
+            << st.evictions << " evictions, " << st.tiles << " tiles ("
+            << st.bytes / 1024 << " KB) resident";
+}
+
+// an image texture filtered like image_texture, its texels paged in
+// through a texture_cache
+class cached_texture final : public texture {
+ public:
+  cached_texture(texture_cache* c, const tiled_texture* f) : cache(c), file(f) {}
+  virtual vec3 value(float u, float v, const vec3& p) const {
+    return lookup(u, v, 0);
+  }
+  virtual vec3 filtered_value(float u, float v, const vec3& p, float footprint) const {
+    return lookup(u, v, footprint);
+  }
+  vec3 lookup(float u, float v, float footprint) const;
+
+  texture_cache* cache;
+  // nullptr when the file could not be opened, the texture is black
+  const tiled_texture* file;
+
+ private:
+  vec3 bilinear(int level, float u, float y) const;
+};
+
+vec3 cached_texture::bilinear(int level, float u, float y) const {
+  const tiled_texture_level& tl = file->levels[level];
+  float x = u * tl.nx - 0.5f;
+  y = y * tl.ny - 0.5f;
+  float fx = floorf(x), fy = floorf(y);
+  int i[2], j[2];
+  i[0] = static_cast<int>(fx);
+  j[0] = static_cast<int>(fy);
+  fx = x - fx;
+  fy = y - fy;
+  i[1] = std::min(std::max(i[0] + 1, 0), tl.nx-1);
+  j[1] = std::min(std::max(j[0] + 1, 0), tl.ny-1);
+  i[0] = std::min(std::max(i[0], 0), tl.nx-1);
+  j[0] = std::min(std::max(j[0], 0), tl.ny-1);
+
+  // the four texels are in one tile unless they straddle a tile edge
+  static const float black[3] = { 0, 0, 0 };
+  std::shared_ptr<const texture_tile> tiles[4];
+  const float* texels[4];
+  for (int k = 0; k < 4; k++) {
+    int ii = i[k & 1], jj = j[k >> 1];
+    int tx = ii / texture_tile_size, ty = jj / texture_tile_size;
+    int same = -1;
+    for (int m = 0; m < k && same < 0; m++)
+      if (i[m & 1] / texture_tile_size == tx && j[m >> 1] / texture_tile_size == ty) same = m;
+    tiles[k] = same >= 0 ? tiles[same] : cache->tile(*file, level, tx, ty);
+    texels[k] = tiles[k] ? &tiles[k]->texels[3 * ((jj % texture_tile_size)*texture_tile_size +
+                                                 ii % texture_tile_size)]
+                         : black;
+  }
+  return bilerp(texels[0], texels[1], texels[2], texels[3], fx, fy);
+}
+
+vec3 cached_texture::lookup(float u, float v, float footprint) const {
+  if (!file) return vec3(0, 0, 0);
+  // the image rows go down, v goes up
+  float y = 1 - v;
+  const tiled_texture_header& h = file->header;
+  float lod = footprint > 0 ? log2f(footprint * sqrtf(float(h.nx) * float(h.ny))) : 0;
+  if (!(lod > 0)) return bilinear(0, u, y);
+  int top = h.levels - 1;
+  if (lod >= top) return bilinear(top, u, y);
+  int l = static_cast<int>(lod);
+  float f = lod - l;
+  return (1 - f) * bilinear(l, u, y) + f * bilinear(l+1, u, y);
+}
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef __THREADPOOLH__
+#define __THREADPOOLH__
+/*
+class thread_pool.
+a small work-stealing pool. every worker owns a deque of jobs,
+it pops from the front of its own deque and steals from the back
+of the others when it runs dry. the calling thread works as worker 0.
+(compile with -pthread)
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class thread_pool {
+ public:
+  explicit thread_pool(int n = 0);
+  ~thread_pool();
+
+  int size() const { return nworkers; }
+  // run fn(0), ..., fn(count-1) on all workers, return when all are done
+  void parallel_for(int count, const std::function<void(int)>& fn);
+
+ private:
+  struct work_queue {
+    std::mutex lock;
+    std::deque<int> jobs;
+  };
+
+  bool pop(int id, int& job);
+  bool steal(int id, int& job);
+  void run_jobs(int id);
+  void worker_loop(int id);
+
+  int nworkers;
+  std::unique_ptr<work_queue[]> queues;
+  std::vector<std::thread> workers;
+  std::atomic<const std::function<void(int)>*> current;
+  std::atomic<int> remaining;
+
+  std::mutex state_lock;
+  std::condition_variable wake;
+  std::condition_variable done;
+  unsigned generation;
+  bool stopping;
+};
+
+thread_pool::thread_pool(int n) : current(nullptr), remaining(0), generation(0), stopping(false) {
+  if (n <= 0) n = static_cast<int>(std::thread::hardware_concurrency());
+  if (n <= 0) n = 1;
+  nworkers = n;
+  queues.reset(new work_queue[n]);
+  for (int i = 1; i < n; i++)
+    workers.emplace_back(&thread_pool::worker_loop, this, i);
+}
+
+thread_pool::~thread_pool() {
+  {
+    std::lock_guard<std::mutex> lk(state_lock);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (size_t i = 0; i < workers.size(); i++)
+    workers[i].join();
+}
+
+bool thread_pool::pop(int id, int& job) {
+  std::lock_guard<std::mutex> lk(queues[id].lock);
+  if (queues[id].jobs.empty()) return false;
+  job = queues[id].jobs.front();
+  queues[id].jobs.pop_front();
+  return true;
+}
+
+bool thread_pool::steal(int id, int& job) {
+  // start from the neighbour, so thieves spread over the victims
+  for (int k = 1; k < nworkers; k++) {
+    work_queue& victim = queues[(id + k) % nworkers];
+    std::lock_guard<std::mutex> lk(victim.lock);
+    if (!victim.jobs.empty()) {
+      job = victim.jobs.back();
+      victim.jobs.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+void thread_pool::run_jobs(int id) {
+  int job;
+  while (pop(id, job) || steal(id, job)) {
+    (*current.load())(job);
+    if (--remaining == 0) {
+      std::lock_guard<std::mutex> lk(state_lock);
+      done.notify_all();
+    }
+  }
+}
+
+void thread_pool::worker_loop(int id) {
+  unsigned seen = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lk(state_lock);
+      wake.wait(lk, [&] { return stopping || generation != seen; });
+      if (stopping) return;
+      seen = generation;
+    }
+    run_jobs(id);
+  }
+}
+
+void thread_pool::parallel_for(int count, const std::function<void(int)>& fn) {
+  if (count <= 0) return;
+  current = &fn;
+  remaining = count;
+  // deal the jobs round-robin, neighbouring jobs land on different workers
+  for (int i = 0; i < count; i++) {
+    std::lock_guard<std::mutex> lk(queues[i % nworkers].lock);
+    queues[i % nworkers].jobs.push_back(i);
+  }
+  {
+    std::lock_guard<std::mutex> lk(state_lock);
+    generation++;
+  }
+  wake.notify_all();
+
+  run_jobs(0);
+  std::unique_lock<std::mutex> lk(state_lock);
+  done.wait(lk, [&] { return remaining.load() == 0; });
+}
+
+#endif
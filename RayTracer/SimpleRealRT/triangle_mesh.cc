@@ -0,0 +1,73 @@
+#include <cstdlib>
+#include <iostream>
+#include "arena.h"
+#include "linear_bvh.h"
+#include "aarect.h"
+#include "instance.h"
+#include "mesh.h"
+#include "camera.h"
+#include "render.h"
+#include "integrator.h"
+#include "texture.h"
+#include "material.h"
+#include "hitable_list.h"
+
+// the cornell box with two cows, both instances of one mesh
+hitable* cornell_mesh(arena& scene, hitable** lights, const mesh_data& data) {
+    hitable** list = scene.make_array<hitable*>(8);
+    int i = 0;
+    material* red = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.65, 0.05, 0.05)) );
+    material* white = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.73, 0.73, 0.73)) );
+    material* green = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.12, 0.45, 0.15)) );
+    material* light = scene.make<diffuse_light>( scene.make<constant_texture>(vec3(15, 15, 15)) );
+    list[i++] = scene.make<flip_normals>(scene.make<yz_rect>(0, 555, 0, 555, 555, green));
+    list[i++] = scene.make<yz_rect>(0, 555, 0, 555, 0, red);
+    // the light is sampled directly too
+    *lights = scene.make<xz_rect>(213, 343, 227, 332, 554, light);
+    list[i++] = *lights;
+    list[i++] = scene.make<flip_normals>(scene.make<xz_rect>(0, 555, 0, 555, 555, white));
+    list[i++] = scene.make<xz_rect>(0, 555, 0, 555, 0, white);
+    list[i++] = scene.make<flip_normals>(scene.make<xy_rect>(0, 555, 0, 555, 555, white));
+
+    hitable* cow = scene.make<triangle_mesh>(data, white);
+    list[i++] = scene.make<instance>(cow, affine::translation(vec3(300, 0, 330)) *
+        affine::rotation_y(-60) * affine::scaling(vec3(16, 16, 16)));
+    list[i++] = scene.make<instance>(cow, affine::translation(vec3(130, 0, 120)) *
+        affine::rotation_y(200) * affine::scaling(vec3(7, 7, 7)));
+    return scene.make<linear_bvh>(list, i, 0.0, 1.0);
+}
+
+int main(int argc, char** argv) {
+  int nx = 1200;
+  int ny = 800;
+  // spp 50, the light is sampled directly
+  int ns = 50;
+
+  // any OBJ file, the cow of the rasterizer by default
+  mesh_data data;
+  if (!load_obj(argc > 1 ? argv[1] : "./src/cow.obj", data)) return 1;
+  if (data.normal_index.empty()) data.compute_normals();
+  std::cerr << data.triangles() << " triangles\n";
+
+  // everything the scene is built of, freed at once
+  arena scene;
+  hitable* lights;
+  hitable* world = cornell_mesh(scene, &lights, data);
+
+  // camera info.
+  // Note that we look to z direction this time.
+  vec3 lookfrom(278, 278, -800);
+  vec3 lookat(278, 278, 0);
+  float dist_to_focus = 10.0;
+  float aspect = float(nx) / float(ny);
+  float vfov = 40;
+  float aperture = 0.0;
+  camera cam(lookfrom, lookat, vec3(0,1,0), vfov,
+             aspect, aperture, dist_to_focus, 0.0, 1.0);
+
+  framebuffer fb(nx, ny);
+  // pinhole camera, coherent camera rays
+  render_packets(fb, cam, world, ns, black_background, lights);
+  write_ppm(stdout, fb);
+  return 0;
+}
@@ -0,0 +1,234 @@
+#ifndef __WIDEBVHH__
+#define __WIDEBVHH__
+/*
+class wide_bvh.
+a W-wide bvh (W = 4: qbvh, W = 8: obvh), collapsed from the SAH splits.
+every node stores the boxes of its W children in SoA layout, so one
+SSE (W = 4) or AVX (W = 8) sequence tests the ray against all of them.
+hit children are visited near to far, and skipped once a closer hit
+is known.
+ */
+
+#include <cassert>
+#include <cfloat>
+#include <vector>
+#include "bvh.h"
+
+#if defined(__SSE__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+template <int W>
+struct alignas(32) wide_bvh_node {
+  // bmin[axis][child]
+  float bmin[3][W];
+  float bmax[3][W];
+  // count > 0: leaf child, its primitives start at slot child[k]
+  // count == 0: interior child at node child[k], or empty when child[k] < 0
+  int child[W];
+  int count[W];
+};
+
+// test the ray against all children, returns the hit mask and
+// the entry distance of every child in tnear
+template <int W>
+inline int wide_slab_hit(const wide_bvh_node<W>& node, const ray& r,
+                         float tmin, float tmax, float tnear[W]) {
+  int mask = 0;
+  for (int k = 0; k < W; k++) {
+    float tn = tmin;
+    float tf = tmax;
+    for (int a = 0; a < 3; a++) {
+      float lo = r.sign[a] ? node.bmax[a][k] : node.bmin[a][k];
+      float hi = r.sign[a] ? node.bmin[a][k] : node.bmax[a][k];
+      tn = ffmax((lo - r.A[a]) * r.inv_B[a], tn);
+      tf = ffmin((hi - r.A[a]) * r.inv_B[a], tf);
+    }
+    tnear[k] = tn;
+    if (tn <= tf) mask |= 1 << k;
+  }
+  return mask;
+}
+
+#if defined(__SSE__)
+template <>
+inline int wide_slab_hit<4>(const wide_bvh_node<4>& node, const ray& r,
+                            float tmin, float tmax, float tnear[4]) {
+  __m128 tn = _mm_set1_ps(tmin);
+  __m128 tf = _mm_set1_ps(tmax);
+  for (int a = 0; a < 3; a++) {
+    // the sign picks the near plane, no min/max needed
+    const float* lo = r.sign[a] ? node.bmax[a] : node.bmin[a];
+    const float* hi = r.sign[a] ? node.bmin[a] : node.bmax[a];
+    __m128 o = _mm_set1_ps(r.A[a]);
+    __m128 inv = _mm_set1_ps(r.inv_B[a]);
+    tn = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(lo), o), inv), tn);
+    tf = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(hi), o), inv), tf);
+  }
+  _mm_storeu_ps(tnear, tn);
+  return _mm_movemask_ps(_mm_cmple_ps(tn, tf));
+}
+#endif
+
+#if defined(__AVX__)
+template <>
+inline int wide_slab_hit<8>(const wide_bvh_node<8>& node, const ray& r,
+                            float tmin, float tmax, float tnear[8]) {
+  __m256 tn = _mm256_set1_ps(tmin);
+  __m256 tf = _mm256_set1_ps(tmax);
+  for (int a = 0; a < 3; a++) {
+    const float* lo = r.sign[a] ? node.bmax[a] : node.bmin[a];
+    const float* hi = r.sign[a] ? node.bmin[a] : node.bmax[a];
+    __m256 o = _mm256_set1_ps(r.A[a]);
+    __m256 inv = _mm256_set1_ps(r.inv_B[a]);
+    tn = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(lo), o), inv), tn);
+    tf = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(hi), o), inv), tf);
+  }
+  _mm256_storeu_ps(tnear, tn);
+  return _mm256_movemask_ps(_mm256_cmp_ps(tn, tf, _CMP_LE_OQ));
+}
+#endif
+
+template <int W>
+class wide_bvh : public hitable {
+ public:
+  wide_bvh() {}
+  wide_bvh(hitable** l, int n, float time0, float time1, int max_leaf = 2);
+  virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+  virtual bool bounding_box(float t0, float t1, aabb& box) const {
+    if (nodes.empty()) return false;
+    box = bbox;
+    return true;
+  }
+
+  // in leaf order
+  std::vector<hitable*> list;
+  std::vector<wide_bvh_node<W> > nodes;
+  aabb bbox;
+
+ private:
+  int build(bvh_primitive* prims, int n, int max_leaf, std::vector<int>& order, int level);
+};
+
+typedef wide_bvh<4> qbvh;
+typedef wide_bvh<8> obvh;
+
+template <int W>
+wide_bvh<W>::wide_bvh(hitable** l, int n, float time0, float time1, int max_leaf) {
+  if (n == 0) return;
+  std::vector<bvh_primitive> prims = gather_primitives(l, n, time0, time1);
+  bbox = primitive_bounds(prims.data(), n);
+  std::vector<int> order;
+  order.reserve(n);
+  build(prims.data(), n, max_leaf, order, 0);
+  list.resize(n);
+  for (int k = 0; k < n; k++)
+    list[k] = l[order[k]];
+}
+
+// collapse the binary SAH splits: keep splitting the child with the
+// largest area until there are W children or all of them are leaves.
+// deep levels split at the median, as in flat_bvh.
+template <int W>
+int wide_bvh<W>::build(bvh_primitive* prims, int n, int max_leaf, std::vector<int>& order,
+                       int level) {
+  int first[W], size[W];
+  aabb box[W];
+  int m = 1;
+  first[0] = 0;
+  size[0] = n;
+  box[0] = primitive_bounds(prims, n);
+  while (m < W) {
+    int best = -1;
+    for (int k = 0; k < m; k++) {
+      if (size[k] > max_leaf && (best < 0 || box[k].area() > box[best].area()))
+        best = k;
+    }
+    if (best < 0) break;
+    int mid = level < bvh_sah_depth ? sah_split(prims + first[best], size[best])
+                                    : median_split(prims + first[best], size[best]);
+    first[m] = first[best] + mid;
+    size[m] = size[best] - mid;
+    box[m] = primitive_bounds(prims + first[m], size[m]);
+    size[best] = mid;
+    box[best] = primitive_bounds(prims + first[best], size[best]);
+    m++;
+  }
+
+  int index = static_cast<int>(nodes.size());
+  nodes.push_back(wide_bvh_node<W>());
+  for (int k = 0; k < W; k++) {
+    for (int a = 0; a < 3; a++) {
+      // empty slots get an inverted box that no ray can enter
+      nodes[index].bmin[a][k] = k < m ? box[k].min()[a] : FLT_MAX;
+      nodes[index].bmax[a][k] = k < m ? box[k].max()[a] : -FLT_MAX;
+    }
+    nodes[index].child[k] = -1;
+    nodes[index].count[k] = 0;
+  }
+  for (int k = 0; k < m; k++) {
+    if (size[k] <= max_leaf) {
+      nodes[index].child[k] = static_cast<int>(order.size());
+      nodes[index].count[k] = size[k];
+      for (int i = 0; i < size[k]; i++)
+        order.push_back(prims[first[k] + i].index);
+    } else {
+      int c = build(prims + first[k], size[k], max_leaf, order, level + 1);
+      // nodes may have moved, index again
+      nodes[index].child[k] = c;
+    }
+  }
+  return index;
+}
+
+template <int W>
+bool wide_bvh<W>::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+  if (nodes.empty()) return false;
+  struct entry {
+    int child;
+    int count;
+    float t;
+  };
+  // every level pushes at most W-1 siblings
+  entry stack[bvh_stack_size*W];
+  int sp = 0;
+  stack[sp++] = { 0, 0, t_min };
+
+  hit_record temp_rec;
+  bool hit_anything = false;
+  while (sp > 0) {
+    entry e = stack[--sp];
+    // entered behind the closest hit so far
+    if (e.t > t_max) continue;
+    if (e.count > 0) {
+      for (int k = e.child; k < e.child + e.count; k++) {
+        if (list[k]->hit(r, t_min, t_max, temp_rec)) {
+          hit_anything = true;
+          t_max = temp_rec.t;
+          rec = temp_rec;
+        }
+      }
+      continue;
+    }
+
+    const wide_bvh_node<W>& node = nodes[e.child];
+    float tnear[W];
+    int mask = wide_slab_hit<W>(node, r, t_min, t_max, tnear);
+    // push far to near, so the nearest child is popped first
+    int base = sp;
+    for (int k = 0; k < W; k++) {
+      if (!(mask & (1 << k))) continue;
+      entry c = { node.child[k], node.count[k], tnear[k] };
+      assert(sp < bvh_stack_size*W);
+      int s = sp++;
+      while (s > base && stack[s-1].t < c.t) {
+        stack[s] = stack[s-1];
+        s--;
+      }
+      stack[s] = c;
+    }
+  }
+  return hit_anything;
+}
+
+#endif